@@ -0,0 +1,149 @@
+#ifndef DRAWCOMMANDS_H
+#define DRAWCOMMANDS_H
+
+#include "glad/glad.h"
+#include "glstate.hpp"
+#include "streambuffer.hpp"
+
+#include <string.h>
+
+#include <vector>
+
+// Indexed draw laid out the way glMultiDrawElementsIndirect reads it
+struct DrawElementsIndirectCommand{
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance;
+};
+
+// Ways to hand a list of indexed draws to GL
+enum DrawSubmit{
+	DRAW_SUBMIT_INDIRECT,	// one glMultiDrawElementsIndirect reading the commands from a buffer (ARB_multi_draw_indirect)
+	DRAW_SUBMIT_MULTI,		// one glMultiDrawElementsBaseVertex from client arrays, not instanced
+	DRAW_SUBMIT_LOOP,		// a glDrawElements*BaseVertex call per command
+	DRAW_SUBMIT_COUNT
+};
+
+const char* const drawSubmitNames[DRAW_SUBMIT_COUNT] = {"indirect", "multi", "loop"};
+
+inline DrawSubmit drawSubmitFromName(const char* name){
+	for(int i = 0; i < DRAW_SUBMIT_COUNT; i++){
+		if(strcmp(name, drawSubmitNames[i]) == 0){
+			return (DrawSubmit)i;
+		}
+	}
+	return DRAW_SUBMIT_COUNT;
+}
+
+// Indexed draws collected on the CPU and submitted together with the vertex array
+// and program in use. The indirect path streams the commands through a ring of
+// GL_DRAW_INDIRECT_BUFFER regions, so building the next list never waits for
+// the GPU to read the last one. Paths the context lacks fall back: indirect to
+// multi, and multi to loop for instanced commands, which it cannot express.
+class DrawCommands{
+	public:
+		std::vector<DrawElementsIndirectCommand> commands;
+
+		// Needs a current GL context for the indirect path
+		DrawCommands(size_t capacity = 1024){
+			stream = NULL;
+			if(GLAD_GL_ARB_multi_draw_indirect){
+				stream = new StreamBuffer(GL_DRAW_INDIRECT_BUFFER, capacity*sizeof(DrawElementsIndirectCommand));
+			}
+		}
+
+		~DrawCommands(){
+			delete stream;
+		}
+
+		static bool supported(DrawSubmit path){
+			return path != DRAW_SUBMIT_INDIRECT || GLAD_GL_ARB_multi_draw_indirect;
+		}
+
+		void clear(){
+			commands.clear();
+		}
+
+		// count indices from firstIndex, offset by baseVertex. Instanced commands with a
+		// baseInstance other than 0 need ARB_base_instance on the loop path.
+		void add(GLuint count, GLuint firstIndex, GLint baseVertex, GLuint instanceCount = 1, GLuint baseInstance = 0){
+			DrawElementsIndirectCommand command = {count, instanceCount, firstIndex, baseVertex, baseInstance};
+			commands.push_back(command);
+		}
+
+		// Path submit() takes for the current commands when asked for path
+		DrawSubmit resolve(DrawSubmit path){
+			if(path == DRAW_SUBMIT_INDIRECT && !supported(path)){
+				path = DRAW_SUBMIT_MULTI;
+			}
+			if(path == DRAW_SUBMIT_MULTI){
+				for(size_t i = 0; i < commands.size(); i++){
+					if(commands[i].instanceCount != 1 || commands[i].baseInstance != 0){
+						return DRAW_SUBMIT_LOOP;
+					}
+				}
+			}
+			return path;
+		}
+
+		// Draws every command as mode primitives from GL_UNSIGNED_SHORT or GL_UNSIGNED_INT indices
+		void submit(GLenum mode, GLenum indexType, DrawSubmit path){
+			if(commands.empty()){
+				return;
+			}
+			size_t indexSize = indexType == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+			path = resolve(path);
+			if(path == DRAW_SUBMIT_INDIRECT){
+				size_t bytes = commands.size()*sizeof(DrawElementsIndirectCommand);
+				if(bytes > stream->size()){
+					// Regions still read by the GPU stay alive until it is done with them
+					delete stream;
+					stream = new StreamBuffer(GL_DRAW_INDIRECT_BUFFER, 2*bytes);
+				}
+				memcpy(stream->beginWrite(), commands.data(), bytes);
+				size_t offset = stream->endWrite();
+				glState().bindBuffer(GL_DRAW_INDIRECT_BUFFER, stream->ID);
+				glMultiDrawElementsIndirect(mode, indexType, (const void*)offset, (GLsizei)commands.size(), 0);
+				stream->fence();
+			}
+			else if(path == DRAW_SUBMIT_MULTI){
+				counts.clear();
+				offsets.clear();
+				baseVertices.clear();
+				for(size_t i = 0; i < commands.size(); i++){
+					counts.push_back(commands[i].count);
+					offsets.push_back((const void*)(commands[i].firstIndex*indexSize));
+					baseVertices.push_back(commands[i].baseVertex);
+				}
+				glMultiDrawElementsBaseVertex(mode, counts.data(), indexType, offsets.data(), (GLsizei)counts.size(), baseVertices.data());
+			}
+			else{
+				for(size_t i = 0; i < commands.size(); i++){
+					const DrawElementsIndirectCommand& command = commands[i];
+					const void* indices = (const void*)(command.firstIndex*indexSize);
+					if(command.baseInstance){
+						glDrawElementsInstancedBaseVertexBaseInstance(mode, command.count, indexType, indices, command.instanceCount, command.baseVertex, command.baseInstance);
+					}
+					else if(command.instanceCount != 1){
+						glDrawElementsInstancedBaseVertex(mode, command.count, indexType, indices, command.instanceCount, command.baseVertex);
+					}
+					else{
+						glDrawElementsBaseVertex(mode, command.count, indexType, indices, command.baseVertex);
+					}
+				}
+			}
+		}
+
+	private:
+		StreamBuffer* stream;
+		// Client arrays of the multi path
+		std::vector<GLsizei> counts;
+		std::vector<const void*> offsets;
+		std::vector<GLint> baseVertices;
+
+		DrawCommands(const DrawCommands&);
+		DrawCommands& operator=(const DrawCommands&);
+};
+#endif
\ No newline at end of file
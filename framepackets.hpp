@@ -0,0 +1,99 @@
+#ifndef FRAMEPACKETS_H
+#define FRAMEPACKETS_H
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+// Two packets handed from a producer thread to a consumer thread. The producer fills
+// one while the consumer works through the other, so it runs at most one packet
+// ahead. The producer never waits to write: a published packet the consumer has not
+// taken yet is handed back to be overwritten with newer state, so the consumer
+// always reads the latest one. Fields that must reach the consumer even when their
+// packet is overwritten have to be carried over by the producer.
+//
+//   Producer: bool stale; T& packet = packets.write(stale); ...fill...; packets.publish(); packets.wait(timeout);
+//   Consumer: while(T* packet = packets.read()){ ...use...; packets.release(); }
+template<typename T>
+class FramePackets{
+	public:
+		FramePackets(){
+			ready = -1;
+			reading = -1;
+			writing = 0;
+			closed = false;
+		}
+
+		// Packet to fill, never waits. stale is set when it is the last published packet,
+		// taken back before the consumer read it; it still holds what was written to it.
+		T& write(bool& stale){
+			std::lock_guard<std::mutex> lock(mutex);
+			stale = ready >= 0;
+			if(stale){
+				writing = ready;
+				ready = -1;
+			}
+			else{
+				writing = reading == 0 ? 1 : 0;
+			}
+			return packets[writing];
+		}
+
+		// Hands the packet from write() to the consumer
+		void publish(){
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				ready = writing;
+			}
+			changed.notify_all();
+		}
+
+		// Waits until the consumer took the last published packet, at most timeout.
+		// False when it is still waiting to be read.
+		bool wait(std::chrono::milliseconds timeout){
+			std::unique_lock<std::mutex> lock(mutex);
+			return changed.wait_for(lock, timeout, [this]{ return ready < 0; });
+		}
+
+		// Next packet, waiting for one; NULL once closed and drained
+		T* read(){
+			std::unique_lock<std::mutex> lock(mutex);
+			changed.wait(lock, [this]{ return ready >= 0 || closed; });
+			if(ready < 0){
+				return NULL;
+			}
+			reading = ready;
+			ready = -1;
+			lock.unlock();
+			changed.notify_all();
+			return &packets[reading];
+		}
+
+		// Gives the packet from read() back to the producer
+		void release(){
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				reading = -1;
+			}
+			changed.notify_all();
+		}
+
+		// Ends reading once the published packet is consumed
+		void close(){
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				closed = true;
+			}
+			changed.notify_all();
+		}
+
+	private:
+		T packets[2];
+		int ready;
+		int reading;
+		int writing;
+		bool closed;
+		std::mutex mutex;
+		std::condition_variable changed;
+};
+#endif
\ No newline at end of file
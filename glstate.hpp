@@ -0,0 +1,308 @@
+#ifndef GLSTATE_H
+#define GLSTATE_H
+
+#include "glad/glad.h"
+
+#include <stdio.h>
+
+// Kinds of calls GLState counts
+enum GLStateCall{
+	GL_STATE_PROGRAM,
+	GL_STATE_VERTEX_ARRAY,
+	GL_STATE_BUFFER,
+	GL_STATE_TEXTURE,		// glActiveTexture and glBindTexture
+	GL_STATE_POLYGON_MODE,
+	GL_STATE_BLEND,			// glEnable/glDisable(GL_BLEND) and glBlendFunc
+	GL_STATE_CALL_COUNT
+};
+
+const char* const glStateCallNames[GL_STATE_CALL_COUNT] = {"program", "vertex array", "buffer", "texture", "polygon mode", "blend"};
+
+// Shadow copy of the render context state that changes while drawing: program,
+// vertex array, buffer bindings, textures per unit, polygon mode and blending.
+// Every setter compares with the last value set and calls GL only on a change,
+// counting issued and skipped calls until resetCounts().
+//
+// Only right while every change to this state goes through it. GL unbinds
+// deleted objects and reuses their names, so deletes must be reported with the
+// forget functions; after anything else changed the state, call invalidate().
+class GLState{
+	public:
+		int issued[GL_STATE_CALL_COUNT];
+		int skipped[GL_STATE_CALL_COUNT];
+
+		GLState(){
+			invalidate();
+			resetCounts();
+		}
+
+		// Treats every piece of state as unknown, the next setter always calls GL
+		void invalidate(){
+			program = UNKNOWN;
+			vertexArray = UNKNOWN;
+			for(int i = 0; i < BUFFER_TARGET_COUNT; i++){
+				buffers[i] = UNKNOWN;
+			}
+			for(unsigned int i = 0; i < UNIFORM_BINDING_COUNT; i++){
+				uniformRanges[i].buffer = UNKNOWN;
+			}
+			activeUnit = UNKNOWN;
+			for(int unit = 0; unit < TEXTURE_UNIT_COUNT; unit++){
+				for(int i = 0; i < TEXTURE_TARGET_COUNT; i++){
+					textures[unit][i] = UNKNOWN;
+				}
+			}
+			polygon = UNKNOWN;
+			blending = -1;
+			blendSource = UNKNOWN;
+			blendDestination = UNKNOWN;
+		}
+
+		void resetCounts(){
+			for(int i = 0; i < GL_STATE_CALL_COUNT; i++){
+				issued[i] = 0;
+				skipped[i] = 0;
+			}
+		}
+
+		int issuedTotal(){
+			int total = 0;
+			for(int i = 0; i < GL_STATE_CALL_COUNT; i++){
+				total += issued[i];
+			}
+			return total;
+		}
+
+		int skippedTotal(){
+			int total = 0;
+			for(int i = 0; i < GL_STATE_CALL_COUNT; i++){
+				total += skipped[i];
+			}
+			return total;
+		}
+
+		// Calls issued/skipped per frame by kind over the frames counted, kinds without calls left out
+		void printCounts(int frames){
+			printf("GL state calls per frame over %d frames: %.1f issued, %.1f skipped (", frames, (double)issuedTotal()/frames, (double)skippedTotal()/frames);
+			bool first = true;
+			for(int i = 0; i < GL_STATE_CALL_COUNT; i++){
+				if(issued[i] || skipped[i]){
+					printf("%s%s %.1f/%.1f", first ? "" : ", ", glStateCallNames[i], (double)issued[i]/frames, (double)skipped[i]/frames);
+					first = false;
+				}
+			}
+			printf(")\n");
+		}
+
+		void useProgram(unsigned int program){
+			if(change(GL_STATE_PROGRAM, this->program, program)){
+				glUseProgram(program);
+			}
+		}
+
+		void bindVertexArray(unsigned int vertexArray){
+			if(change(GL_STATE_VERTEX_ARRAY, this->vertexArray, vertexArray)){
+				glBindVertexArray(vertexArray);
+				// The element array binding belongs to the vertex array
+				buffers[bufferIndex(GL_ELEMENT_ARRAY_BUFFER)] = UNKNOWN;
+			}
+		}
+
+		// Targets without a slot here are always bound
+		void bindBuffer(GLenum target, unsigned int buffer){
+			int index = bufferIndex(target);
+			if(index < 0){
+				count(GL_STATE_BUFFER, true);
+				glBindBuffer(target, buffer);
+			}
+			else if(change(GL_STATE_BUFFER, buffers[index], buffer)){
+				glBindBuffer(target, buffer);
+			}
+		}
+
+		// Binds a range of buffer to an indexed target, GL_UNIFORM_BUFFER bindings below
+		// UNIFORM_BINDING_COUNT are tracked. Like GL, also binds buffer to target itself.
+		void bindBufferRange(GLenum target, unsigned int index, unsigned int buffer, size_t offset, size_t size){
+			int slot = bufferIndex(target);
+			if(slot >= 0){
+				buffers[slot] = buffer;
+			}
+			if(target == GL_UNIFORM_BUFFER && index < UNIFORM_BINDING_COUNT){
+				BufferRange& range = uniformRanges[index];
+				if(range.buffer == buffer && range.offset == offset && range.size == size){
+					count(GL_STATE_BUFFER, false);
+					return;
+				}
+				range.buffer = buffer;
+				range.offset = offset;
+				range.size = size;
+			}
+			count(GL_STATE_BUFFER, true);
+			glBindBufferRange(target, index, buffer, (GLintptr)offset, (GLsizeiptr)size);
+		}
+
+		// Binds texture to target on unit, making unit active if it is not
+		void bindTexture(int unit, GLenum target, unsigned int texture){
+			int index = textureIndex(target);
+			if(index < 0 || unit >= TEXTURE_UNIT_COUNT){
+				activeTexture(unit);
+				count(GL_STATE_TEXTURE, true);
+				glBindTexture(target, texture);
+				if(unit < TEXTURE_UNIT_COUNT && index >= 0){
+					textures[unit][index] = texture;
+				}
+				return;
+			}
+			if(textures[unit][index] == texture){
+				count(GL_STATE_TEXTURE, false);
+				return;
+			}
+			activeTexture(unit);
+			textures[unit][index] = texture;
+			count(GL_STATE_TEXTURE, true);
+			glBindTexture(target, texture);
+		}
+
+		void activeTexture(int unit){
+			if(change(GL_STATE_TEXTURE, activeUnit, (unsigned int)unit)){
+				glActiveTexture(GL_TEXTURE0 + unit);
+			}
+		}
+
+		void polygonMode(GLenum mode){
+			if(change(GL_STATE_POLYGON_MODE, polygon, mode)){
+				glPolygonMode(GL_FRONT_AND_BACK, mode);
+			}
+		}
+
+		void blend(bool enabled){
+			if(blending == (int)enabled){
+				count(GL_STATE_BLEND, false);
+				return;
+			}
+			blending = enabled;
+			count(GL_STATE_BLEND, true);
+			if(enabled){
+				glEnable(GL_BLEND);
+			}
+			else{
+				glDisable(GL_BLEND);
+			}
+		}
+
+		void blendFunc(GLenum source, GLenum destination){
+			if(blendSource == source && blendDestination == destination){
+				count(GL_STATE_BLEND, false);
+				return;
+			}
+			blendSource = source;
+			blendDestination = destination;
+			count(GL_STATE_BLEND, true);
+			glBlendFunc(source, destination);
+		}
+
+		// Call after deleting objects that may be bound
+		void forgetProgram(unsigned int program){
+			forget(this->program, program);
+		}
+
+		void forgetVertexArray(unsigned int vertexArray){
+			forget(this->vertexArray, vertexArray);
+		}
+
+		void forgetBuffer(unsigned int buffer){
+			for(int i = 0; i < BUFFER_TARGET_COUNT; i++){
+				forget(buffers[i], buffer);
+			}
+			for(unsigned int i = 0; i < UNIFORM_BINDING_COUNT; i++){
+				forget(uniformRanges[i].buffer, buffer);
+			}
+		}
+
+		void forgetTexture(unsigned int texture){
+			for(int unit = 0; unit < TEXTURE_UNIT_COUNT; unit++){
+				for(int i = 0; i < TEXTURE_TARGET_COUNT; i++){
+					forget(textures[unit][i], texture);
+				}
+			}
+		}
+
+	private:
+		static const unsigned int UNKNOWN = 0xFFFFFFFF;
+		static const int BUFFER_TARGET_COUNT = 8;
+		static const int TEXTURE_UNIT_COUNT = 16;
+		static const int TEXTURE_TARGET_COUNT = 5;
+		static const unsigned int UNIFORM_BINDING_COUNT = 16;
+
+		struct BufferRange{
+			unsigned int buffer;
+			size_t offset;
+			size_t size;
+		};
+
+		unsigned int program;
+		unsigned int vertexArray;
+		unsigned int buffers[BUFFER_TARGET_COUNT];
+		BufferRange uniformRanges[UNIFORM_BINDING_COUNT];
+		unsigned int activeUnit;
+		unsigned int textures[TEXTURE_UNIT_COUNT][TEXTURE_TARGET_COUNT];
+		unsigned int polygon;
+		int blending;
+		unsigned int blendSource;
+		unsigned int blendDestination;
+
+		static int bufferIndex(GLenum target){
+			switch(target){
+				case GL_ARRAY_BUFFER: return 0;
+				case GL_ELEMENT_ARRAY_BUFFER: return 1;
+				case GL_PIXEL_UNPACK_BUFFER: return 2;
+				case GL_PIXEL_PACK_BUFFER: return 3;
+				case GL_TEXTURE_BUFFER: return 4;
+				case GL_UNIFORM_BUFFER: return 5;
+				case GL_DRAW_INDIRECT_BUFFER: return 6;
+				case GL_COPY_WRITE_BUFFER: return 7;
+				default: return -1;
+			}
+		}
+
+		static int textureIndex(GLenum target){
+			switch(target){
+				case GL_TEXTURE_2D: return 0;
+				case GL_TEXTURE_BUFFER: return 1;
+				case GL_TEXTURE_2D_ARRAY: return 2;
+				case GL_TEXTURE_3D: return 3;
+				case GL_TEXTURE_CUBE_MAP: return 4;
+				default: return -1;
+			}
+		}
+
+		void count(GLStateCall call, bool issue){
+			if(issue){
+				issued[call]++;
+			}
+			else{
+				skipped[call]++;
+			}
+		}
+
+		// Stores value in slot and returns true when it differs from what slot held
+		bool change(GLStateCall call, unsigned int& slot, unsigned int value){
+			bool changed = slot != value;
+			slot = value;
+			count(call, changed);
+			return changed;
+		}
+
+		static void forget(unsigned int& slot, unsigned int object){
+			if(slot == object){
+				slot = UNKNOWN;
+			}
+		}
+};
+
+// State of the render context. Other contexts, like the shader compile worker, must not use it.
+inline GLState& glState(){
+	static GLState state;
+	return state;
+}
+#endif
\ No newline at end of file
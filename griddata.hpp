@@ -0,0 +1,185 @@
+#ifndef GRIDDATA_H
+#define GRIDDATA_H
+
+#include "gridgen.hpp"
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Range of cell indices [first, last) in row-major order
+struct GridSpan{
+	unsigned int first, last;
+};
+
+// Index of the lowest set bit, bits must be non-zero
+inline int gridLowestBit(uint64_t bits){
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, bits);
+	return (int)index;
+#else
+	return __builtin_ctzll(bits);
+#endif
+}
+
+// CPU copy of the grid, the source every GPU upload is made from. Changed
+// cells are recorded in one bitset per upload target (one per stream region),
+// so each region only receives the spans it has not seen yet instead of a
+// full remap. While no cell was changed since the last seed, a whole upload
+// can be generated from the seed instead (GridGenerator), and the copy itself
+// is only filled in once a cell changes.
+class GridData{
+	public:
+		int gridSize;
+		std::vector<GridInstance> cells;
+		// Seed of the last generate() or reseed()
+		unsigned int seed;
+
+		GridData(int gridSize, int targetCount){
+			this->gridSize = gridSize;
+			seed = 0;
+			fromSeed = false;
+			stale = false;
+			cells.resize((size_t)gridSize*gridSize);
+			for(int y = 0; y < gridSize; y++){
+				for(int x = 0; x < gridSize; x++){
+					cells[(size_t)gridSize*y + x].x = (unsigned short)x;
+					cells[(size_t)gridSize*y + x].y = (unsigned short)y;
+				}
+			}
+			dirtyBits.resize(targetCount, std::vector<uint64_t>((cells.size() + 63)/64, 0));
+			dirtyCount.resize(targetCount, 0);
+			full.resize(targetCount, true);
+		}
+
+		// Regenerates every cell from the seed
+		void generate(GridWorkers* workers, unsigned int seed){
+			this->seed = seed;
+			fill(workers);
+			fromSeed = true;
+			markAll();
+		}
+
+		// generate() for targets that make the grid from seed themselves: the cells are
+		// left as they are until materialize() fills them in
+		void reseed(unsigned int seed){
+			this->seed = seed;
+			fromSeed = true;
+			stale = true;
+			markAll();
+		}
+
+		// Brings the cells up to date after reseed(), needed before setColor()
+		void materialize(GridWorkers* workers){
+			if(stale){
+				fill(workers);
+			}
+		}
+
+		// True while every cell is what seed gives it, so a whole upload can be made from seed
+		bool seeded(){
+			return fromSeed;
+		}
+
+		void setColor(int x, int y, unsigned int color){
+			unsigned int cell = (unsigned int)gridSize*y + x;
+			fromSeed = false;
+			cells[cell].color = color;
+			markDirty(cell);
+		}
+
+		void markAll(){
+			for(size_t i = 0; i < full.size(); i++){
+				if(!full[i]){
+					full[i] = true;
+					clearBits(i);
+				}
+			}
+		}
+
+		void markDirty(unsigned int cell){
+			uint64_t bit = (uint64_t)1 << (cell & 63);
+			for(size_t i = 0; i < full.size(); i++){
+				if(full[i]){
+					continue;
+				}
+				uint64_t& word = dirtyBits[i][cell >> 6];
+				if(!(word & bit)){
+					word |= bit;
+					dirtyCount[i]++;
+				}
+				// Past half the grid a full copy is cheaper than walking the spans
+				if(dirtyCount[i] > cells.size()/2){
+					full[i] = true;
+					clearBits(i);
+				}
+			}
+		}
+
+		bool dirty(int target){
+			return full[target] || dirtyCount[target] != 0;
+		}
+
+		// Moves the changes target has not received yet into spans, in cell order.
+		// Returns true when target needs the whole grid instead.
+		bool takeDirty(int target, std::vector<GridSpan>& spans){
+			spans.clear();
+			if(full[target]){
+				full[target] = false;
+				return true;
+			}
+			if(dirtyCount[target] == 0){
+				return false;
+			}
+
+			std::vector<uint64_t>& bits = dirtyBits[target];
+			for(size_t w = 0; w < bits.size(); w++){
+				uint64_t word = bits[w];
+				bits[w] = 0;
+				while(word){
+					unsigned int cell = (unsigned int)(w*64) + gridLowestBit(word);
+					word &= word - 1;
+					if(!spans.empty() && spans.back().last == cell){
+						spans.back().last++;
+					}
+					else{
+						GridSpan span = {cell, cell + 1};
+						spans.push_back(span);
+					}
+				}
+			}
+			dirtyCount[target] = 0;
+			return false;
+		}
+
+	private:
+		bool fromSeed;
+		bool stale;
+		std::vector<std::vector<uint64_t>> dirtyBits;
+		std::vector<size_t> dirtyCount;
+		std::vector<char> full;
+
+		void fill(GridWorkers* workers){
+			GridInstance* out = cells.data();
+			int size = gridSize;
+			unsigned int seed = this->seed;
+			workers->run(gridSize, [=](int firstRow, int lastRow){
+				generateInstanceRows(out, size, firstRow, lastRow, seed);
+			});
+			stale = false;
+		}
+
+		void clearBits(size_t target){
+			if(dirtyCount[target]){
+				std::fill(dirtyBits[target].begin(), dirtyBits[target].end(), 0);
+				dirtyCount[target] = 0;
+			}
+		}
+};
+#endif
\ No newline at end of file
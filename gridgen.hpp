@@ -0,0 +1,394 @@
+#ifndef GRIDGEN_H
+#define GRIDGEN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GRIDGEN_SSE2
+#include <emmintrin.h>
+#endif
+
+// Per-cell instance record, 8 bytes. Color is RGBA8, red in the lowest byte.
+struct GridInstance{
+	unsigned short x, y;
+	unsigned int color;
+};
+
+// Counter-based RNG: the color of a cell depends only on (seed, cell index),
+// so any split of rows across threads produces the same grid.
+inline unsigned int gridHash(unsigned int seed, unsigned int counter){
+	unsigned int x = counter + seed * 0x9E3779B9u;
+	x ^= x >> 16;
+	x *= 0x7FEB352Du;
+	x ^= x >> 15;
+	x *= 0x846CA68Bu;
+	x ^= x >> 16;
+	return x;
+}
+
+// Packed RGBA8 color of a cell, alpha forced to 255
+inline unsigned int gridColor(unsigned int seed, unsigned int cell){
+	return gridHash(seed, cell) | 0xFF000000u;
+}
+
+#ifdef GRIDGEN_SSE2
+// 32-bit lane multiply, SSE2 has no _mm_mullo_epi32
+inline __m128i gridMullo(__m128i a, __m128i b){
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+// gridColor() for four consecutive cells
+inline __m128i gridColor4(unsigned int seed, unsigned int cell){
+	__m128i x = _mm_add_epi32(_mm_setr_epi32(cell, cell+1, cell+2, cell+3), _mm_set1_epi32(seed * 0x9E3779B9u));
+	x = _mm_xor_si128(x, _mm_srli_epi32(x, 16));
+	x = gridMullo(x, _mm_set1_epi32(0x7FEB352D));
+	x = _mm_xor_si128(x, _mm_srli_epi32(x, 15));
+	x = gridMullo(x, _mm_set1_epi32((int)0x846CA68Bu));
+	x = _mm_xor_si128(x, _mm_srli_epi32(x, 16));
+	return _mm_or_si128(x, _mm_set1_epi32((int)0xFF000000u));
+}
+#endif
+
+// Writes rows [firstRow, lastRow) of the instance stream. instances points at the start of the buffer.
+inline void generateInstanceRows(GridInstance* instances, int gridSize, int firstRow, int lastRow, unsigned int seed){
+	for(int y = firstRow; y < lastRow; y++){
+		unsigned int square = (unsigned int)gridSize*y;
+		GridInstance* out = instances + square;
+		int x = 0;
+#ifdef GRIDGEN_SSE2
+		// Two 8 byte instances per 16 byte store, four cells per iteration
+		__m128i rowY = _mm_set1_epi32((int)((unsigned int)y << 16));
+		for(; x + 4 <= gridSize; x += 4){
+			__m128i colors = gridColor4(seed, square + x);
+			__m128i positions = _mm_or_si128(_mm_setr_epi32(x, x+1, x+2, x+3), rowY);
+			_mm_storeu_si128((__m128i*)(out + x), _mm_unpacklo_epi32(positions, colors));
+			_mm_storeu_si128((__m128i*)(out + x + 2), _mm_unpackhi_epi32(positions, colors));
+		}
+#endif
+		for(; x < gridSize; x++){
+			out[x].x = (unsigned short)x;
+			out[x].y = (unsigned short)y;
+			out[x].color = gridColor(seed, square + x);
+		}
+	}
+}
+
+// Colors only of rows [firstRow, lastRow), the same colors generateInstanceRows gives the cells
+inline void generateColorRows(unsigned int* colors, int gridSize, int firstRow, int lastRow, unsigned int seed){
+	for(int y = firstRow; y < lastRow; y++){
+		unsigned int square = (unsigned int)gridSize*y;
+		unsigned int* out = colors + (size_t)square;
+		int x = 0;
+#ifdef GRIDGEN_SSE2
+		for(; x + 4 <= gridSize; x += 4){
+			_mm_storeu_si128((__m128i*)(out + x), gridColor4(seed, square + x));
+		}
+#endif
+		for(; x < gridSize; x++){
+			out[x] = gridColor(seed, square + x);
+		}
+	}
+}
+
+// Expands cells [first, last) of the instance stream into the expanded vertex stream,
+// 4 vertices x 8 floats per cell. vertices points at the start of the buffer.
+inline void expandInstances(float* vertices, const GridInstance* instances, size_t first, size_t last){
+	const float toUnit = 1.0f / 255.0f;
+	float* vertexOut = vertices + first*32;
+	size_t cell = first;
+#ifdef GRIDGEN_SSE2
+	const __m128 unit = _mm_set1_ps(toUnit);
+	const __m128i byteMask = _mm_set1_epi32(0xFF);
+	for(; cell < last; cell++){
+		unsigned int color = instances[cell].color;
+		__m128 rgb = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_setr_epi32(color, color >> 8, color >> 16, 0), byteMask)), unit);
+		float cx = (float)instances[cell].x;
+		float cy = (float)instances[cell].y;
+		float r = _mm_cvtss_f32(rgb);
+		// [g b u v] with texcoords filled in per corner
+		__m128 gb = _mm_shuffle_ps(rgb, rgb, _MM_SHUFFLE(3, 3, 2, 1));
+		_mm_storeu_ps(vertexOut + 0, _mm_setr_ps(0.5f+cx, 0.5f+cy, 0.0f, r));
+		_mm_storeu_ps(vertexOut + 4, _mm_add_ps(gb, _mm_setr_ps(0.0f, 0.0f, 1.0f, 1.0f)));
+		_mm_storeu_ps(vertexOut + 8, _mm_setr_ps(0.5f+cx, -0.5f+cy, 0.0f, r));
+		_mm_storeu_ps(vertexOut + 12, _mm_add_ps(gb, _mm_setr_ps(0.0f, 0.0f, 1.0f, 0.0f)));
+		_mm_storeu_ps(vertexOut + 16, _mm_setr_ps(-0.5f+cx, -0.5f+cy, 0.0f, r));
+		_mm_storeu_ps(vertexOut + 20, gb);
+		_mm_storeu_ps(vertexOut + 24, _mm_setr_ps(-0.5f+cx, 0.5f+cy, 0.0f, r));
+		_mm_storeu_ps(vertexOut + 28, _mm_add_ps(gb, _mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f)));
+		vertexOut += 32;
+	}
+#endif
+	for(; cell < last; cell++){
+		unsigned int color = instances[cell].color;
+		float x = instances[cell].x;
+		float y = instances[cell].y;
+		float colorRed = (color & 0xFF) * toUnit;
+		float colorGreen = ((color >> 8) & 0xFF) * toUnit;
+		float colorBlue = ((color >> 16) & 0xFF) * toUnit;
+		float vertices[] = {
+			0.5f+x, 0.5f+y, 0.0f,		colorRed, colorGreen, colorBlue,	1.0f, 1.0f,
+			0.5f+x, -0.5f+y, 0.0f,		colorRed, colorGreen, colorBlue,	1.0f, 0.0f,
+
+			-0.5f+x, -0.5f+y, 0.0f,		colorRed, colorGreen, colorBlue,	0.0f, 0.0f,
+			-0.5f+x, 0.5f+y, 0.0f,		colorRed, colorGreen, colorBlue,	0.0f, 1.0f
+		};
+
+		for(int i = 0; i < 32; i++){
+			vertexOut[i] = vertices[i];
+		}
+		vertexOut += 32;
+	}
+}
+
+// Packed expanded vertex: integer corner position (cell x or x+1, y or y+1) and RGBA8 color, 8 bytes
+struct PackedVertex{
+	unsigned short x, y;
+	unsigned int color;
+};
+
+// PackedVertex plus unorm16 texcoords, 12 bytes
+struct PackedTexVertex{
+	unsigned short x, y;
+	unsigned int color;
+	unsigned short u, v;
+};
+
+// Expands cells [first, last) into 4 PackedVertex per cell, corners in the same order as expandInstances
+inline void expandInstancesPacked(PackedVertex* vertices, const GridInstance* instances, size_t first, size_t last){
+	PackedVertex* vertexOut = vertices + first*4;
+	size_t cell = first;
+#ifdef GRIDGEN_SSE2
+	// Corner offsets as (x | y << 16) lanes interleaved with color: (1,1) (1,0) (0,0) (0,1)
+	const __m128i cornersHigh = _mm_setr_epi32(0x00010001, 0, 0x00000001, 0);
+	const __m128i cornersLow = _mm_setr_epi32(0x00000000, 0, 0x00010000, 0);
+	for(; cell < last; cell++){
+		const GridInstance* in = instances + cell;
+		__m128i position = _mm_set1_epi32((int)(in->x | ((unsigned int)in->y << 16)));
+		__m128i pair = _mm_unpacklo_epi32(position, _mm_set1_epi32((int)in->color));
+		pair = _mm_unpacklo_epi64(pair, pair);
+		_mm_storeu_si128((__m128i*)(vertexOut + 0), _mm_add_epi32(pair, cornersHigh));
+		_mm_storeu_si128((__m128i*)(vertexOut + 2), _mm_add_epi32(pair, cornersLow));
+		vertexOut += 4;
+	}
+#endif
+	for(; cell < last; cell++){
+		const GridInstance* in = instances + cell;
+		PackedVertex vertices[] = {
+			{(unsigned short)(in->x+1), (unsigned short)(in->y+1), in->color},
+			{(unsigned short)(in->x+1), in->y, in->color},
+			{in->x, in->y, in->color},
+			{in->x, (unsigned short)(in->y+1), in->color}
+		};
+		for(int i = 0; i < 4; i++){
+			vertexOut[i] = vertices[i];
+		}
+		vertexOut += 4;
+	}
+}
+
+// Expands cells [first, last) into 4 PackedTexVertex per cell
+inline void expandInstancesPackedTex(PackedTexVertex* vertices, const GridInstance* instances, size_t first, size_t last){
+	PackedTexVertex* vertexOut = vertices + first*4;
+	size_t cell = first;
+#ifdef GRIDGEN_SSE2
+	// 4 vertices are 12 dwords, three 16 byte stores
+	for(; cell < last; cell++){
+		const GridInstance* in = instances + cell;
+		int position = (int)(in->x | ((unsigned int)in->y << 16));
+		int color = (int)in->color;
+		__m128i* out = (__m128i*)vertexOut;
+		_mm_storeu_si128(out + 0, _mm_setr_epi32(position + 0x00010001, color, (int)0xFFFFFFFFu, position + 0x00000001));
+		_mm_storeu_si128(out + 1, _mm_setr_epi32(color, 0x0000FFFF, position, color));
+		_mm_storeu_si128(out + 2, _mm_setr_epi32(0, position + 0x00010000, color, (int)0xFFFF0000u));
+		vertexOut += 4;
+	}
+#endif
+	for(; cell < last; cell++){
+		const GridInstance* in = instances + cell;
+		PackedTexVertex vertices[] = {
+			{(unsigned short)(in->x+1), (unsigned short)(in->y+1), in->color, 65535, 65535},
+			{(unsigned short)(in->x+1), in->y, in->color, 65535, 0},
+			{in->x, in->y, in->color, 0, 0},
+			{in->x, (unsigned short)(in->y+1), in->color, 0, 65535}
+		};
+		for(int i = 0; i < 4; i++){
+			vertexOut[i] = vertices[i];
+		}
+		vertexOut += 4;
+	}
+}
+
+// Expands cells [first, last) into 4 colors per cell; positions come from gl_VertexID
+inline void expandInstancesColor(unsigned int* vertices, const GridInstance* instances, size_t first, size_t last){
+	unsigned int* vertexOut = vertices + first*4;
+	size_t cell = first;
+#ifdef GRIDGEN_SSE2
+	for(; cell < last; cell++){
+		_mm_storeu_si128((__m128i*)vertexOut, _mm_set1_epi32((int)instances[cell].color));
+		vertexOut += 4;
+	}
+#endif
+	for(; cell < last; cell++){
+		for(int i = 0; i < 4; i++){
+			vertexOut[i] = instances[cell].color;
+		}
+		vertexOut += 4;
+	}
+}
+
+// Writes rows [firstRow, lastRow) of the expanded index stream, 6 indices per cell.
+// Only depends on gridSize, so it is written once rather than on every remap.
+inline void generateIndexRows(unsigned int* indices, int gridSize, int firstRow, int lastRow){
+	for(int y = firstRow; y < lastRow; y++){
+		unsigned int square = (unsigned int)gridSize*y;
+		unsigned int* indexOut = indices + (size_t)square*6;
+		int x = 0;
+#ifdef GRIDGEN_SSE2
+		for(; x + 2 <= gridSize; x += 2){
+			// 12 indices for two cells in three stores
+			__m128i base0 = _mm_set1_epi32((square + x)*4);
+			__m128i base1 = _mm_set1_epi32((square + x + 1)*4);
+			_mm_storeu_si128((__m128i*)(indexOut + 0), _mm_add_epi32(base0, _mm_setr_epi32(0, 1, 3, 1)));
+			_mm_storeu_si128((__m128i*)(indexOut + 4), _mm_add_epi32(_mm_unpacklo_epi64(base0, base1), _mm_setr_epi32(2, 3, 0, 1)));
+			_mm_storeu_si128((__m128i*)(indexOut + 8), _mm_add_epi32(base1, _mm_setr_epi32(3, 1, 2, 3)));
+			indexOut += 12;
+		}
+#endif
+		for(; x < gridSize; x++){
+			unsigned int cell = square + x;
+			unsigned int indices[] = {
+				0+cell*4, 1+cell*4, 3+cell*4,
+				1+cell*4, 2+cell*4, 3+cell*4
+			};
+
+			for(int i = 0; i < 6; i++){
+				indexOut[i] = indices[i];
+			}
+			indexOut += 6;
+		}
+	}
+}
+
+// Cells per chunk when the expanded grid is drawn with 16-bit indices: 4 vertices each, 65536 per chunk
+#define GRID_CHUNK_CELLS 16384
+
+// Writes the index pattern of one chunk, 6 indices per cell relative to the chunk's first vertex.
+// Every chunk shares it through the base vertex of its draw.
+inline void generateChunkIndices(unsigned short* indices, int cellCount){
+	for(int cell = 0; cell < cellCount; cell++){
+		unsigned short base = (unsigned short)(cell*4);
+		unsigned short pattern[] = {
+			(unsigned short)(base+0), (unsigned short)(base+1), (unsigned short)(base+3),
+			(unsigned short)(base+1), (unsigned short)(base+2), (unsigned short)(base+3)
+		};
+		for(int i = 0; i < 6; i++){
+			indices[cell*6 + i] = pattern[i];
+		}
+	}
+}
+
+// Fixed pool of worker threads. run() splits [0, rows) into one contiguous
+// range per thread (the calling thread takes the first) and blocks until all are done.
+class GridWorkers{
+	public:
+		GridWorkers(int threadCount){
+			if(threadCount < 1){
+				threadCount = 1;
+			}
+			generation = 0;
+			pending = 0;
+			stopping = false;
+			jobRows = 0;
+			for(int i = 1; i < threadCount; i++){
+				threads.push_back(std::thread(&GridWorkers::workerLoop, this, i));
+			}
+		}
+
+		~GridWorkers(){
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stopping = true;
+			}
+			wake.notify_all();
+			for(size_t i = 0; i < threads.size(); i++){
+				threads[i].join();
+			}
+		}
+
+		int size(){
+			return (int)threads.size() + 1;
+		}
+
+		void run(int rows, std::function<void(int, int)> job){
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				currentJob = job;
+				jobRows = rows;
+				pending = (int)threads.size();
+				generation++;
+			}
+			wake.notify_all();
+
+			runSlice(0, rows, job);
+
+			std::unique_lock<std::mutex> lock(mutex);
+			done.wait(lock, [this]{ return pending == 0; });
+			currentJob = nullptr;
+		}
+
+	private:
+		std::vector<std::thread> threads;
+		std::mutex mutex;
+		std::condition_variable wake;
+		std::condition_variable done;
+		std::function<void(int, int)> currentJob;
+		unsigned long generation;
+		int pending;
+		int jobRows;
+		bool stopping;
+
+		void runSlice(int slice, int rows, const std::function<void(int, int)>& job){
+			int count = size();
+			int first = (int)((long long)rows*slice/count);
+			int last = (int)((long long)rows*(slice + 1)/count);
+			if(first < last){
+				job(first, last);
+			}
+		}
+
+		void workerLoop(int slice){
+			unsigned long seen = 0;
+			while(true){
+				std::function<void(int, int)> job;
+				int rows;
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					wake.wait(lock, [&]{ return stopping || generation != seen; });
+					if(stopping){
+						return;
+					}
+					seen = generation;
+					job = currentJob;
+					rows = jobRows;
+				}
+
+				runSlice(slice, rows, job);
+
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					pending--;
+				}
+				done.notify_one();
+			}
+		}
+};
+#endif
\ No newline at end of file
@@ -0,0 +1,103 @@
+#ifndef GRIDGPU_H
+#define GRIDGPU_H
+
+#include "glad/glad.h"
+#include "glstate.hpp"
+#include "shader.hpp"
+#include "shadersource.hpp"
+#include "streambuffer.hpp"
+#include "vertexformat.hpp"
+
+#include <stdio.h>
+
+// Fills a cell stream region with the grid of a seed on the GPU: the same bytes
+// GridData::generate and expandVertices give on the CPU, without the CPU writing
+// or the bus carrying any of them. GL 3.3 core has no compute shaders, so
+// shaders/gridgen.vs runs once per output record with rasterization off and
+// transform feedback captures its outputs straight into the buffer.
+class GridGenerator{
+	public:
+		// Bytes per cell of the output
+		size_t cellSize;
+
+		// expanded writes 4 vertices in format per cell, otherwise a GridInstance per cell.
+		// valid() is false when the program failed to load, compile or link.
+		GridGenerator(const char* shaderPath, int gridSize, bool expanded, VertexFormat format){
+			this->gridSize = gridSize;
+			this->expanded = expanded;
+			static const char* const formatDefines[VERTEX_FORMAT_COUNT] = {"FLOAT_VERTEX", "PACKED_VERTEX", "PACKED_UV_VERTEX", "VERTEXID_VERTEX"};
+			int words = expanded ? vertexFormats[format].stride/4 : (int)sizeof(GridInstance)/4;
+			cellSize = expanded ? 4*vertexFormats[format].stride : sizeof(GridInstance);
+			program = 0;
+			glGenVertexArrays(1, &vertexArray);
+
+			ShaderSource source;
+			if(!source.load(shaderPath, expanded ? formatDefines[format] : "INSTANCE")){
+				return;
+			}
+			const char* code = source.code.c_str();
+			unsigned int vertex = glCreateShader(GL_VERTEX_SHADER);
+			glShaderSource(vertex, 1, &code, NULL);
+			glCompileShader(vertex);
+			program = glCreateProgram();
+			glAttachShader(program, vertex);
+			// Interleaved, each record is the words in order
+			const char* varyings[8] = {"word0", "word1", "word2", "word3", "word4", "word5", "word6", "word7"};
+			glTransformFeedbackVaryings(program, words, varyings, GL_INTERLEAVED_ATTRIBS);
+			glLinkProgram(program);
+			glDeleteShader(vertex);
+			if(!Shader::linked(program)){
+				glDeleteProgram(program);
+				program = 0;
+				return;
+			}
+			seedLocation = glGetUniformLocation(program, "seed");
+			glState().useProgram(program);
+			glUniform1i(glGetUniformLocation(program, "gridSize"), gridSize);
+		}
+
+		~GridGenerator(){
+			if(program){
+				glDeleteProgram(program);
+				glState().forgetProgram(program);
+			}
+			glDeleteVertexArrays(1, &vertexArray);
+			glState().forgetVertexArray(vertexArray);
+		}
+
+		bool valid(){
+			return program != 0;
+		}
+
+		// Bytes of a whole grid
+		size_t size(){
+			return (size_t)gridSize*gridSize*cellSize;
+		}
+
+		// Writes the grid of seed into the next region of stream and makes it the current one
+		void generate(StreamBuffer* stream, unsigned int seed){
+			generate(stream->ID, stream->gpuWrite(), seed);
+		}
+
+		// Writes the grid of seed into buffer from offset, a multiple of 4
+		void generate(unsigned int buffer, size_t offset, unsigned int seed){
+			glState().useProgram(program);
+			glUniform1ui(seedLocation, seed);
+			glState().bindVertexArray(vertexArray);
+			glState().bindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 0, buffer, offset, size());
+			glEnable(GL_RASTERIZER_DISCARD);
+			glBeginTransformFeedback(GL_POINTS);
+			glDrawArrays(GL_POINTS, 0, (GLsizei)((size_t)gridSize*gridSize*(expanded ? 4 : 1)));
+			glEndTransformFeedback();
+			glDisable(GL_RASTERIZER_DISCARD);
+		}
+
+	private:
+		int gridSize;
+		bool expanded;
+		unsigned int program;
+		// Empty, core profile draws need one bound
+		unsigned int vertexArray;
+		int seedLocation;
+};
+#endif
\ No newline at end of file
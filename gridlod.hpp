@@ -0,0 +1,304 @@
+#ifndef GRIDLOD_H
+#define GRIDLOD_H
+
+#include "glad/glad.h"
+#include "glstate.hpp"
+#include "gridgen.hpp"
+#include "gridtiles.hpp"
+#include "glm/glm.hpp"
+
+#include <stddef.h>
+
+#include <algorithm>
+#include <vector>
+
+// Quadtree node picked for drawing: tileSize x tileSize texels of level, starting at texel (x, y)
+struct GridLodNode{
+	unsigned short x, y;
+	unsigned short level;
+	unsigned short padding;
+};
+
+// Level of detail for very large grids. The colors live in a mip pyramid: level 0
+// holds one RGBA8 texel per cell and every level above averages 2x2 texels of the
+// one below, so a texel of level L stands for 2^L x 2^L cells. Every level is cut
+// into tileSize square tiles, which makes the pyramid a quadtree; select() walks it
+// from the root and stops at the first node whose texels project to at most
+// maxTexelPixels, so a frame draws about one quad per pixel however large the grid.
+class GridLod{
+	public:
+		int gridSize;
+		int tileSize;
+		int levelCount;
+		// Mip pyramid on the GPU, levels are padded up to a power of two multiple of the coarsest level
+		unsigned int texture;
+		std::vector<std::vector<unsigned int>> levels;
+		// Nodes drawn and culled by the last select(), and the levels drawn
+		int drawn;
+		int culled;
+		int finestLevel;
+		int coarsestLevel;
+
+		GridLod(int gridSize, int tileSize = GRID_TILE_SIZE){
+			this->gridSize = gridSize;
+			this->tileSize = tileSize;
+			levelCount = countLevels(gridSize, tileSize);
+			drawn = 0;
+			culled = 0;
+			finestLevel = 0;
+			coarsestLevel = 0;
+			full = true;
+			dirtyCount = 0;
+
+			levels.resize(levelCount);
+			for(int level = 0; level < levelCount; level++){
+				levels[level].resize((size_t)levelSize(level)*levelSize(level));
+			}
+			dirtyTiles.resize((size_t)tilesPerSide(0)*tilesPerSide(0), 0);
+
+			// GL mip sizes round down, the pyramid rounds up: pad level 0 so every level fits
+			int padded = paddedSize(gridSize, tileSize);
+			glGenTextures(1, &texture);
+			glState().bindTexture(0, GL_TEXTURE_2D, texture);
+			for(int level = 0; level < levelCount; level++){
+				glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, padded >> level, padded >> level, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+			}
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levelCount - 1);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		}
+
+		~GridLod(){
+			glDeleteTextures(1, &texture);
+			glState().forgetTexture(texture);
+		}
+
+		// Width of the level 0 texture, check it against GL_MAX_TEXTURE_SIZE before constructing
+		static int paddedSize(int gridSize, int tileSize = GRID_TILE_SIZE){
+			int top = countLevels(gridSize, tileSize) - 1;
+			return ((gridSize + (1 << top) - 1) >> top) << top;
+		}
+
+		int levelSize(int level){
+			return (gridSize + (1 << level) - 1) >> level;
+		}
+
+		int tilesPerSide(int level){
+			return (levelSize(level) + tileSize - 1)/tileSize;
+		}
+
+		// Regenerates level 0 from the seed, the levels above are rebuilt by the next build()
+		void generate(GridWorkers* workers, unsigned int seed){
+			unsigned int* out = levels[0].data();
+			int size = gridSize;
+			workers->run(gridSize, [=](int firstRow, int lastRow){
+				generateColorRows(out, size, firstRow, lastRow, seed);
+			});
+			full = true;
+		}
+
+		void setColor(int x, int y, unsigned int color){
+			levels[0][(size_t)gridSize*y + x] = color;
+			if(full){
+				return;
+			}
+			char& tile = dirtyTiles[(size_t)tilesPerSide(0)*(y/tileSize) + x/tileSize];
+			if(!tile){
+				tile = 1;
+				dirtyCount++;
+			}
+			// Past half the tiles one pass over the whole pyramid is cheaper
+			if(dirtyCount > dirtyTiles.size()/2){
+				full = true;
+			}
+		}
+
+		// Rebuilds the levels above changed cells on the CPU, no GL needed. update() uploads them.
+		void build(GridWorkers* workers){
+			if(full){
+				for(int level = 1; level < levelCount; level++){
+					int size = levelSize(level);
+					workers->run(size, [=](int firstRow, int lastRow){
+						downsample(level, 0, firstRow, size, lastRow);
+					});
+				}
+				return;
+			}
+			for(size_t i = 0; i < dirtyTiles.size(); i++){
+				if(dirtyTiles[i]){
+					int x0, y0, x1, y1;
+					tileCells(i, x0, y0, x1, y1);
+					for(int level = 1; level < levelCount; level++){
+						downsample(level, x0 >> level, y0 >> level, ((x1 - 1) >> level) + 1, ((y1 - 1) >> level) + 1);
+					}
+				}
+			}
+		}
+
+		// Uploads what the last build() rebuilt
+		void update(){
+			if(!full && dirtyCount == 0){
+				return;
+			}
+			glState().bindTexture(0, GL_TEXTURE_2D, texture);
+			if(full){
+				for(int level = 0; level < levelCount; level++){
+					upload(level, 0, 0, levelSize(level), levelSize(level));
+				}
+			}
+			else{
+				for(size_t i = 0; i < dirtyTiles.size(); i++){
+					if(!dirtyTiles[i]){
+						continue;
+					}
+					int x0, y0, x1, y1;
+					tileCells(i, x0, y0, x1, y1);
+					for(int level = 0; level < levelCount; level++){
+						upload(level, x0 >> level, y0 >> level, ((x1 - 1) >> level) + 1, ((y1 - 1) >> level) + 1);
+					}
+				}
+			}
+			std::fill(dirtyTiles.begin(), dirtyTiles.end(), 0);
+			dirtyCount = 0;
+			full = false;
+		}
+
+		// Fills nodes with the quadtree nodes to draw for transform (clip = transform * position)
+		// on a viewport of width x height pixels
+		void select(const glm::mat4& transform, int width, int height, float maxTexelPixels, std::vector<GridLodNode>& nodes){
+			gridFrustumPlanes(transform, planes);
+			this->transform = transform;
+			halfViewport = glm::vec2(width*0.5f, height*0.5f);
+			this->maxTexelPixels = maxTexelPixels;
+			nodes.clear();
+			drawn = 0;
+			culled = 0;
+			finestLevel = levelCount;
+			coarsestLevel = 0;
+			visit(levelCount - 1, 0, 0, nodes);
+		}
+
+	private:
+		bool full;
+		size_t dirtyCount;
+		// One flag per level 0 tile with cells changed since the last update()
+		std::vector<char> dirtyTiles;
+
+		glm::vec4 planes[6];
+		glm::mat4 transform;
+		glm::vec2 halfViewport;
+		float maxTexelPixels;
+
+		// Enough levels for the coarsest to fit in one tile
+		static int countLevels(int gridSize, int tileSize){
+			int count = 1;
+			while((tileSize << (count - 1)) < gridSize){
+				count++;
+			}
+			return count;
+		}
+
+		// Cells [x0, x1) x [y0, y1) of level 0 tile i
+		void tileCells(size_t i, int& x0, int& y0, int& x1, int& y1){
+			int tiles = tilesPerSide(0);
+			x0 = (int)(i % tiles)*tileSize;
+			y0 = (int)(i / tiles)*tileSize;
+			x1 = std::min(x0 + tileSize, gridSize);
+			y1 = std::min(y0 + tileSize, gridSize);
+		}
+
+		// Texels [x0, x1) x [y0, y1) of level from the 2x2 texels below, edges average what exists
+		void downsample(int level, int x0, int y0, int x1, int y1){
+			const unsigned int* below = levels[level - 1].data();
+			unsigned int* out = levels[level].data();
+			int belowSize = levelSize(level - 1);
+			int size = levelSize(level);
+			for(int y = y0; y < y1; y++){
+				for(int x = x0; x < x1; x++){
+					int bx = x*2;
+					int by = y*2;
+					const unsigned int* row = below + (size_t)belowSize*by;
+					if(bx + 1 < belowSize && by + 1 < belowSize){
+						// Two channels per 32 bit lane, the sums of 4 bytes stay below the next channel
+						unsigned int a = row[bx], b = row[bx + 1], c = row[bx + belowSize], d = row[bx + belowSize + 1];
+						unsigned int rb = (a & 0x00FF00FF) + (b & 0x00FF00FF) + (c & 0x00FF00FF) + (d & 0x00FF00FF) + 0x00020002;
+						unsigned int ga = ((a >> 8) & 0x00FF00FF) + ((b >> 8) & 0x00FF00FF) + ((c >> 8) & 0x00FF00FF) + ((d >> 8) & 0x00FF00FF) + 0x00020002;
+						out[(size_t)size*y + x] = ((rb >> 2) & 0x00FF00FF) | (((ga >> 2) & 0x00FF00FF) << 8);
+						continue;
+					}
+					unsigned int sums[4] = {0, 0, 0, 0};
+					unsigned int count = 0;
+					for(int dy = 0; dy < 2 && by + dy < belowSize; dy++){
+						for(int dx = 0; dx < 2 && bx + dx < belowSize; dx++){
+							unsigned int color = row[(size_t)belowSize*dy + bx + dx];
+							for(int channel = 0; channel < 4; channel++){
+								sums[channel] += (color >> (channel*8)) & 0xFF;
+							}
+							count++;
+						}
+					}
+					unsigned int color = 0;
+					for(int channel = 0; channel < 4; channel++){
+						color |= ((sums[channel] + count/2)/count) << (channel*8);
+					}
+					out[(size_t)size*y + x] = color;
+				}
+			}
+		}
+
+		// Copies texels [x0, x1) x [y0, y1) of level to the bound texture
+		void upload(int level, int x0, int y0, int x1, int y1){
+			glPixelStorei(GL_UNPACK_ROW_LENGTH, levelSize(level));
+			glPixelStorei(GL_UNPACK_SKIP_PIXELS, x0);
+			glPixelStorei(GL_UNPACK_SKIP_ROWS, y0);
+			glTexSubImage2D(GL_TEXTURE_2D, level, x0, y0, x1 - x0, y1 - y0, GL_RGBA, GL_UNSIGNED_BYTE, levels[level].data());
+			glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+			glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+			glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+		}
+
+		// Pixel length of one texel of level at cell (x, y), along whichever grid axis projects longer
+		float texelPixels(int level, float x, float y){
+			float step = (float)(1 << level);
+			glm::vec4 origin = transform*glm::vec4(x, y, 0.0f, 1.0f);
+			glm::vec4 alongX = transform*glm::vec4(x + step, y, 0.0f, 1.0f);
+			glm::vec4 alongY = transform*glm::vec4(x, y + step, 0.0f, 1.0f);
+			if(origin.w <= 0.0f || alongX.w <= 0.0f || alongY.w <= 0.0f){
+				return maxTexelPixels*2.0f;
+			}
+			glm::vec2 o = glm::vec2(origin)/origin.w;
+			glm::vec2 dx = (glm::vec2(alongX)/alongX.w - o)*halfViewport;
+			glm::vec2 dy = (glm::vec2(alongY)/alongY.w - o)*halfViewport;
+			return std::max(glm::length(dx), glm::length(dy));
+		}
+
+		void visit(int level, int nx, int ny, std::vector<GridLodNode>& nodes){
+			int span = tileSize << level;
+			float minX = nx*(float)span - 0.5f;
+			float minY = ny*(float)span - 0.5f;
+			float maxX = std::min((nx + 1)*span, gridSize) - 0.5f;
+			float maxY = std::min((ny + 1)*span, gridSize) - 0.5f;
+			if(!gridBoxVisible(planes, minX, minY, maxX, maxY)){
+				culled++;
+				return;
+			}
+			if(level == 0 || texelPixels(level, minX, minY) <= maxTexelPixels){
+				GridLodNode node = {(unsigned short)(nx*tileSize), (unsigned short)(ny*tileSize), (unsigned short)level, 0};
+				nodes.push_back(node);
+				drawn++;
+				finestLevel = std::min(finestLevel, level);
+				coarsestLevel = std::max(coarsestLevel, level);
+				return;
+			}
+			int children = tilesPerSide(level - 1);
+			for(int dy = 0; dy < 2; dy++){
+				for(int dx = 0; dx < 2; dx++){
+					if(nx*2 + dx < children && ny*2 + dy < children){
+						visit(level - 1, nx*2 + dx, ny*2 + dy, nodes);
+					}
+				}
+			}
+		}
+};
+#endif
\ No newline at end of file
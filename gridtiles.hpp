@@ -0,0 +1,128 @@
+#ifndef GRIDTILES_H
+#define GRIDTILES_H
+
+#include "griddata.hpp"
+#include "glm/glm.hpp"
+
+#include <vector>
+
+// Side of a square tile in cells
+#define GRID_TILE_SIZE 32
+
+// Frustum planes of transform (clip = transform * position) straight from the matrix rows: w +- x, w +- y, w +- z >= 0
+inline void gridFrustumPlanes(const glm::mat4& transform, glm::vec4 planes[6]){
+	glm::vec4 w(transform[0][3], transform[1][3], transform[2][3], transform[3][3]);
+	for(int i = 0; i < 3; i++){
+		glm::vec4 row(transform[0][i], transform[1][i], transform[2][i], transform[3][i]);
+		planes[i*2] = w + row;
+		planes[i*2 + 1] = w - row;
+	}
+}
+
+// The grid lies in z = 0, so a box is outside when its corner furthest along some plane is behind it
+inline bool gridBoxVisible(const glm::vec4 planes[6], float minX, float minY, float maxX, float maxY){
+	for(int p = 0; p < 6; p++){
+		float x = planes[p].x > 0.0f ? maxX : minX;
+		float y = planes[p].y > 0.0f ? maxY : minY;
+		if(planes[p].x*x + planes[p].y*y + planes[p].w < 0.0f){
+			return false;
+		}
+	}
+	return true;
+}
+
+// Splits the grid into square tiles and tests each tile's bounding box against the
+// view frustum on the CPU. Cells stay in row-major order, so a visible tile is drawn
+// as one span per cell row; spans of neighbouring visible tiles are merged, which
+// turns a fully visible grid back into a single draw.
+class GridTiles{
+	public:
+		int gridSize;
+		int tileSize;
+		int tilesPerSide;
+		// Tiles drawn and culled by the last cull()
+		int drawn;
+		int culled;
+
+		GridTiles(int gridSize, int tileSize = GRID_TILE_SIZE){
+			this->gridSize = gridSize;
+			this->tileSize = tileSize;
+			tilesPerSide = (gridSize + tileSize - 1)/tileSize;
+			drawn = 0;
+			culled = 0;
+			visible.resize(tilesPerSide);
+		}
+
+		// Fills spans with the cells of every tile inside the frustum of transform (clip = transform * position)
+		void cull(const glm::mat4& transform, std::vector<GridSpan>& spans){
+			glm::vec4 planes[6];
+			gridFrustumPlanes(transform, planes);
+
+			spans.clear();
+			drawn = 0;
+			culled = 0;
+			for(int ty = 0; ty < tilesPerSide; ty++){
+				float minY = ty*tileSize - 0.5f;
+				float maxY = tileEnd(ty) - 0.5f;
+				for(int tx = 0; tx < tilesPerSide; tx++){
+					float minX = tx*tileSize - 0.5f;
+					float maxX = tileEnd(tx) - 0.5f;
+					bool inside = gridBoxVisible(planes, minX, minY, maxX, maxY);
+					visible[tx] = inside;
+					if(inside){
+						drawn++;
+					}
+					else{
+						culled++;
+					}
+				}
+				addTileRow(ty, spans);
+			}
+		}
+
+		// Every tile visible, a single span over the grid
+		void all(std::vector<GridSpan>& spans){
+			spans.clear();
+			GridSpan span = {0, (unsigned int)gridSize*gridSize};
+			spans.push_back(span);
+			drawn = tilesPerSide*tilesPerSide;
+			culled = 0;
+		}
+
+	private:
+		// Visibility of the tiles in the row being culled
+		std::vector<char> visible;
+
+		int tileEnd(int tile){
+			int end = (tile + 1)*tileSize;
+			return end < gridSize ? end : gridSize;
+		}
+
+		// Appends the cell rows of tile row ty, one span per run of visible tiles
+		void addTileRow(int ty, std::vector<GridSpan>& spans){
+			for(int y = ty*tileSize; y < tileEnd(ty); y++){
+				unsigned int rowStart = (unsigned int)gridSize*y;
+				int tx = 0;
+				while(tx < tilesPerSide){
+					if(!visible[tx]){
+						tx++;
+						continue;
+					}
+					int runStart = tx;
+					while(tx < tilesPerSide && visible[tx]){
+						tx++;
+					}
+					unsigned int first = rowStart + runStart*tileSize;
+					unsigned int last = rowStart + tileEnd(tx - 1);
+					if(!spans.empty() && spans.back().last == first){
+						spans.back().last = last;
+					}
+					else{
+						GridSpan span = {first, last};
+						spans.push_back(span);
+					}
+				}
+			}
+		}
+};
+#endif
\ No newline at end of file
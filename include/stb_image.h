@@ -238,12 +238,44 @@ RECENT REVISION HISTORY:
 // (at least this is true for iOS and Android). Therefore, the NEON support is
 // toggled by a build flag: define STBI_NEON to get NEON loops.
 //
+// On x86 the JPEG decoder also has AVX2 kernels, which it picks over the SSE2
+// ones at run time when the CPU and OS support AVX2. The IDCT does two 8x8
+// blocks per pass, upsampling and color conversion 16 pixels. GCC and Clang
+// build them with a per-function target attribute, so no -mavx2 is needed and
+// the rest of the program still runs on any x86. Their output is identical to
+// the SSE2 and C versions. Define STBI_NO_AVX2 to leave them out.
+//
 // If for some reason you do not want to use any of SIMD code, or if
 // you have issues compiling it, you can disable it entirely by
 // defining STBI_NO_SIMD.
 //
 // ===========================================================================
 //
+// Multithreaded decoding
+//
+// stb_image creates no threads itself. Hand it a function that spreads work
+// over yours with stbi_set_parallel_for() and the JPEG decoder uses it:
+//
+//    void my_parallel_for(void *user, stbi_parallel_task *task, void *data, int count)
+//    {
+//       // call task(data, first, last) on ranges covering [0,count) exactly
+//       // once, from any threads, concurrently or not; return when all are done
+//    }
+//
+// There is one hook per process. Install it before any decode that should use
+// it starts, and remove it with stbi_set_parallel_for(NULL, user) once they have
+// all returned. Installing fails, returning 0, while another hook is in place,
+// and only the user that installed a hook can remove it.
+//
+// Baseline JPEGs with restart markers (DRI) decode their restart intervals
+// in parallel, entropy decoding and IDCT included. Progressive JPEGs run
+// their final dequantize and IDCT in parallel. Both upsample and color
+// convert in bands of rows in parallel. Restart intervals are only split
+// up when decoding from memory. Intact files decode to the same pixels either
+// way; a damaged interval no longer ends the decode of the ones after it.
+//
+// ===========================================================================
+//
 // HDR image support   (disable by defining STBI_NO_HDR)
 //
 // stb_image supports loading HDR images in general, and currently the Radiance
@@ -491,6 +523,13 @@ STBIDEF void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip);
 // calling it will fail to link if your compiler doesn't
 STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_flip);
 
+// run decoding work on your threads, see "Multithreaded decoding" above;
+// set it before loading, NULL (the default) decodes on the calling thread only.
+// returns 0 if another user's hook is installed, which is left in place
+typedef void stbi_parallel_task(void *data, int first, int last);
+typedef void stbi_parallel_for(void *user, stbi_parallel_task *task, void *data, int count);
+STBIDEF int stbi_set_parallel_for(stbi_parallel_for *parallel_for, void *user);
+
 // ZLIB client - used by PNG, available for other purposes
 
 STBIDEF char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial_size, int *outlen);
@@ -610,12 +649,14 @@ typedef unsigned short stbi__uint16;
 typedef   signed short stbi__int16;
 typedef unsigned int   stbi__uint32;
 typedef   signed int   stbi__int32;
+typedef unsigned __int64 stbi__uint64;
 #else
 #include <stdint.h>
 typedef uint16_t stbi__uint16;
 typedef int16_t  stbi__int16;
 typedef uint32_t stbi__uint32;
 typedef int32_t  stbi__int32;
+typedef uint64_t stbi__uint64;
 #endif
 
 // should produce compiler error if size is wrong
@@ -717,7 +758,7 @@ static int stbi__cpuid3(void)
 
 #define STBI_SIMD_ALIGN(type, name) __declspec(align(16)) type name
 
-#if !defined(STBI_NO_JPEG) && defined(STBI_SSE2)
+#if (!defined(STBI_NO_JPEG) || !defined(STBI_NO_PNG)) && defined(STBI_SSE2)
 static int stbi__sse2_available(void)
 {
    int info3 = stbi__cpuid3();
@@ -728,7 +769,7 @@ static int stbi__sse2_available(void)
 #else // assume GCC-style if not VC++
 #define STBI_SIMD_ALIGN(type, name) type name __attribute__((aligned(16)))
 
-#if !defined(STBI_NO_JPEG) && defined(STBI_SSE2)
+#if (!defined(STBI_NO_JPEG) || !defined(STBI_NO_PNG)) && defined(STBI_SSE2)
 static int stbi__sse2_available(void)
 {
    // If we're even attempting to compile this on GCC/Clang, that means
@@ -741,6 +782,38 @@ static int stbi__sse2_available(void)
 #endif
 #endif
 
+// x86 AVX2, picked over SSE2 at run time
+#if defined(STBI_SSE2) && !defined(STBI_NO_JPEG) && !defined(STBI_NO_AVX2) && \
+    (defined(__clang__) || (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))) || \
+     (defined(_MSC_VER) && _MSC_VER >= 1700))
+#define STBI_AVX2
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#define STBI__AVX2_TARGET
+
+static int stbi__avx2_available(void)
+{
+   int info[4];
+   __cpuid(info,1);
+   // OSXSAVE and AVX, and the OS saves the xmm and ymm state
+   if ((info[2] & 0x18000000) != 0x18000000 || (_xgetbv(0) & 6) != 6)
+      return 0;
+   __cpuidex(info,7,0);
+   return (info[1] >> 5) & 1;
+}
+#else
+// only the avx2 kernels are compiled for avx2, everything else stays sse2
+#define STBI__AVX2_TARGET __attribute__((target("avx2")))
+
+static int stbi__avx2_available(void)
+{
+   // includes the check that the OS saves the ymm state
+   return __builtin_cpu_supports("avx2");
+}
+#endif
+#endif
+
 // ARM NEON
 #if defined(STBI_NO_SIMD) && defined(STBI_NEON)
 #undef STBI_NEON
@@ -1080,6 +1153,22 @@ STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_fli
                                          : stbi__vertically_flip_on_load_global)
 #endif // STBI_THREAD_LOCAL
 
+static stbi_parallel_for *stbi__parallel_for = NULL;
+static void *stbi__parallel_user = NULL;
+
+STBIDEF int stbi_set_parallel_for(stbi_parallel_for *parallel_for, void *user)
+{
+   if (parallel_for == NULL) {
+      // only the installing user removes a hook
+      if (stbi__parallel_for && stbi__parallel_user != user) return 0;
+   } else {
+      if (stbi__parallel_for && (stbi__parallel_for != parallel_for || stbi__parallel_user != user)) return 0;
+   }
+   stbi__parallel_for = parallel_for;
+   stbi__parallel_user = user;
+   return 1;
+}
+
 static void *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri, int bpc)
 {
    memset(ri, 0, sizeof(*ri)); // make sure it's initialized if we add new fields
@@ -1935,6 +2024,7 @@ typedef struct
 
 // kernels
    void (*idct_block_kernel)(stbi_uc *out, int out_stride, short data[64]);
+   void (*idct_block2_kernel)(stbi_uc *out, int out_stride, short data[128]); // two side by side blocks, or NULL
    void (*YCbCr_to_RGB_kernel)(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, int count, int step);
    stbi_uc *(*resample_row_hv_2_kernel)(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs);
 } stbi__jpeg;
@@ -2630,6 +2720,196 @@ static void stbi__idct_simd(stbi_uc *out, int out_stride, short data[64])
 
 #endif // STBI_SSE2
 
+#ifdef STBI_AVX2
+// avx2 integer IDCT of two horizontally adjacent blocks, data[0..63] to out
+// and data[64..127] to out+8. every step of the sse2 version stays within
+// its 128-bit lane, so this runs it on one block per lane and is just as
+// bit-identical.
+STBI__AVX2_TARGET
+static void stbi__idct_avx2(stbi_uc *out, int out_stride, short data[128])
+{
+   __m256i row0, row1, row2, row3, row4, row5, row6, row7;
+   __m256i tmp;
+
+   // dot product constant: even elems=x, odd elems=y
+   #define dct_const(x,y)  _mm256_setr_epi16((x),(y),(x),(y),(x),(y),(x),(y),(x),(y),(x),(y),(x),(y),(x),(y))
+
+   // out(0) = c0[even]*x + c0[odd]*y   (c0, x, y 16-bit, out 32-bit)
+   // out(1) = c1[even]*x + c1[odd]*y
+   #define dct_rot(out0,out1, x,y,c0,c1) \
+      __m256i c0##lo = _mm256_unpacklo_epi16((x),(y)); \
+      __m256i c0##hi = _mm256_unpackhi_epi16((x),(y)); \
+      __m256i out0##_l = _mm256_madd_epi16(c0##lo, c0); \
+      __m256i out0##_h = _mm256_madd_epi16(c0##hi, c0); \
+      __m256i out1##_l = _mm256_madd_epi16(c0##lo, c1); \
+      __m256i out1##_h = _mm256_madd_epi16(c0##hi, c1)
+
+   // out = in << 12  (in 16-bit, out 32-bit)
+   #define dct_widen(out, in) \
+      __m256i out##_l = _mm256_srai_epi32(_mm256_unpacklo_epi16(_mm256_setzero_si256(), (in)), 4); \
+      __m256i out##_h = _mm256_srai_epi32(_mm256_unpackhi_epi16(_mm256_setzero_si256(), (in)), 4)
+
+   // wide add
+   #define dct_wadd(out, a, b) \
+      __m256i out##_l = _mm256_add_epi32(a##_l, b##_l); \
+      __m256i out##_h = _mm256_add_epi32(a##_h, b##_h)
+
+   // wide sub
+   #define dct_wsub(out, a, b) \
+      __m256i out##_l = _mm256_sub_epi32(a##_l, b##_l); \
+      __m256i out##_h = _mm256_sub_epi32(a##_h, b##_h)
+
+   // butterfly a/b, add bias, then shift by "s" and pack
+   #define dct_bfly32o(out0, out1, a,b,bias,s) \
+      { \
+         __m256i abiased_l = _mm256_add_epi32(a##_l, bias); \
+         __m256i abiased_h = _mm256_add_epi32(a##_h, bias); \
+         dct_wadd(sum, abiased, b); \
+         dct_wsub(dif, abiased, b); \
+         out0 = _mm256_packs_epi32(_mm256_srai_epi32(sum_l, s), _mm256_srai_epi32(sum_h, s)); \
+         out1 = _mm256_packs_epi32(_mm256_srai_epi32(dif_l, s), _mm256_srai_epi32(dif_h, s)); \
+      }
+
+   // 8-bit interleave step (for transposes)
+   #define dct_interleave8(a, b) \
+      tmp = a; \
+      a = _mm256_unpacklo_epi8(a, b); \
+      b = _mm256_unpackhi_epi8(tmp, b)
+
+   // 16-bit interleave step (for transposes)
+   #define dct_interleave16(a, b) \
+      tmp = a; \
+      a = _mm256_unpacklo_epi16(a, b); \
+      b = _mm256_unpackhi_epi16(tmp, b)
+
+   #define dct_pass(bias,shift) \
+      { \
+         /* even part */ \
+         dct_rot(t2e,t3e, row2,row6, rot0_0,rot0_1); \
+         __m256i sum04 = _mm256_add_epi16(row0, row4); \
+         __m256i dif04 = _mm256_sub_epi16(row0, row4); \
+         dct_widen(t0e, sum04); \
+         dct_widen(t1e, dif04); \
+         dct_wadd(x0, t0e, t3e); \
+         dct_wsub(x3, t0e, t3e); \
+         dct_wadd(x1, t1e, t2e); \
+         dct_wsub(x2, t1e, t2e); \
+         /* odd part */ \
+         dct_rot(y0o,y2o, row7,row3, rot2_0,rot2_1); \
+         dct_rot(y1o,y3o, row5,row1, rot3_0,rot3_1); \
+         __m256i sum17 = _mm256_add_epi16(row1, row7); \
+         __m256i sum35 = _mm256_add_epi16(row3, row5); \
+         dct_rot(y4o,y5o, sum17,sum35, rot1_0,rot1_1); \
+         dct_wadd(x4, y0o, y4o); \
+         dct_wadd(x5, y1o, y5o); \
+         dct_wadd(x6, y2o, y5o); \
+         dct_wadd(x7, y3o, y4o); \
+         dct_bfly32o(row0,row7, x0,x7,bias,shift); \
+         dct_bfly32o(row1,row6, x1,x6,bias,shift); \
+         dct_bfly32o(row2,row5, x2,x5,bias,shift); \
+         dct_bfly32o(row3,row4, x3,x4,bias,shift); \
+      }
+
+   // row r of the first block in the low lane, of the second in the high one
+   #define dct_load(r) \
+      _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_load_si128((const __m128i *) (data + (r)*8))), \
+                              _mm_load_si128((const __m128i *) (data + 64 + (r)*8)), 1)
+
+   // each lane holds two output rows of its block; store both rows 16 pixels wide
+   #define dct_store2(p) \
+      tmp = _mm256_permute4x64_epi64(p, 0xd8); \
+      _mm_storeu_si128((__m128i *) out, _mm256_castsi256_si128(tmp)); out += out_stride; \
+      _mm_storeu_si128((__m128i *) out, _mm256_extracti128_si256(tmp, 1)); out += out_stride
+
+   __m256i rot0_0 = dct_const(stbi__f2f(0.5411961f), stbi__f2f(0.5411961f) + stbi__f2f(-1.847759065f));
+   __m256i rot0_1 = dct_const(stbi__f2f(0.5411961f) + stbi__f2f( 0.765366865f), stbi__f2f(0.5411961f));
+   __m256i rot1_0 = dct_const(stbi__f2f(1.175875602f) + stbi__f2f(-0.899976223f), stbi__f2f(1.175875602f));
+   __m256i rot1_1 = dct_const(stbi__f2f(1.175875602f), stbi__f2f(1.175875602f) + stbi__f2f(-2.562915447f));
+   __m256i rot2_0 = dct_const(stbi__f2f(-1.961570560f) + stbi__f2f( 0.298631336f), stbi__f2f(-1.961570560f));
+   __m256i rot2_1 = dct_const(stbi__f2f(-1.961570560f), stbi__f2f(-1.961570560f) + stbi__f2f( 3.072711026f));
+   __m256i rot3_0 = dct_const(stbi__f2f(-0.390180644f) + stbi__f2f( 2.053119869f), stbi__f2f(-0.390180644f));
+   __m256i rot3_1 = dct_const(stbi__f2f(-0.390180644f), stbi__f2f(-0.390180644f) + stbi__f2f( 1.501321110f));
+
+   // rounding biases in column/row passes, see stbi__idct_block for explanation.
+   __m256i bias_0 = _mm256_set1_epi32(512);
+   __m256i bias_1 = _mm256_set1_epi32(65536 + (128<<17));
+
+   // load
+   row0 = dct_load(0);
+   row1 = dct_load(1);
+   row2 = dct_load(2);
+   row3 = dct_load(3);
+   row4 = dct_load(4);
+   row5 = dct_load(5);
+   row6 = dct_load(6);
+   row7 = dct_load(7);
+
+   // column pass
+   dct_pass(bias_0, 10);
+
+   {
+      // 16bit 8x8 transpose pass 1
+      dct_interleave16(row0, row4);
+      dct_interleave16(row1, row5);
+      dct_interleave16(row2, row6);
+      dct_interleave16(row3, row7);
+
+      // transpose pass 2
+      dct_interleave16(row0, row2);
+      dct_interleave16(row1, row3);
+      dct_interleave16(row4, row6);
+      dct_interleave16(row5, row7);
+
+      // transpose pass 3
+      dct_interleave16(row0, row1);
+      dct_interleave16(row2, row3);
+      dct_interleave16(row4, row5);
+      dct_interleave16(row6, row7);
+   }
+
+   // row pass
+   dct_pass(bias_1, 17);
+
+   {
+      // pack
+      __m256i p0 = _mm256_packus_epi16(row0, row1); // a0a1a2a3...a7b0b1b2b3...b7, per lane
+      __m256i p1 = _mm256_packus_epi16(row2, row3);
+      __m256i p2 = _mm256_packus_epi16(row4, row5);
+      __m256i p3 = _mm256_packus_epi16(row6, row7);
+
+      // 8bit 8x8 transpose pass 1
+      dct_interleave8(p0, p2); // a0e0a1e1...
+      dct_interleave8(p1, p3); // c0g0c1g1...
+
+      // transpose pass 2
+      dct_interleave8(p0, p1); // a0c0e0g0...
+      dct_interleave8(p2, p3); // b0d0f0h0...
+
+      // transpose pass 3
+      dct_interleave8(p0, p2); // a0b0c0d0...
+      dct_interleave8(p1, p3); // a4b4c4d4...
+
+      // store
+      dct_store2(p0);
+      dct_store2(p2);
+      dct_store2(p1);
+      dct_store2(p3);
+   }
+
+#undef dct_const
+#undef dct_rot
+#undef dct_widen
+#undef dct_wadd
+#undef dct_wsub
+#undef dct_bfly32o
+#undef dct_interleave8
+#undef dct_interleave16
+#undef dct_pass
+#undef dct_load
+#undef dct_store2
+}
+#endif // STBI_AVX2
+
 #ifdef STBI_NEON
 
 // NEON integer IDCT. should produce bit-identical
@@ -2872,13 +3152,162 @@ static void stbi__jpeg_reset(stbi__jpeg *j)
    // since we don't even allow 1<<30 pixels
 }
 
+// idct two horizontally adjacent blocks, data[0..63] to out and data[64..127] to out+8
+stbi_inline static void stbi__jpeg_idct_pair(stbi__jpeg *z, stbi_uc *out, int out_stride, short data[128])
+{
+   if (z->idct_block2_kernel) {
+      z->idct_block2_kernel(out, out_stride, data);
+   } else {
+      z->idct_block_kernel(out, out_stride, data);
+      z->idct_block_kernel(out+8, out_stride, data+64);
+   }
+}
+
+// decode the baseline MCU at column i, row j and idct its blocks into the
+// component planes; the MCUs of a non-interleaved scan are single blocks
+stbi_inline static int stbi__jpeg_decode_mcu(stbi__jpeg *z, short data[128], int i, int j)
+{
+   int k,x,y;
+   if (z->scan_n == 1) {
+      int n = z->order[0];
+      int ha = z->img_comp[n].ha;
+      if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+      z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+      return 1;
+   }
+   // scan an interleaved mcu... process scan_n components in order
+   for (k=0; k < z->scan_n; ++k) {
+      int n = z->order[k];
+      // scan out an mcu's worth of this component; that's just determined
+      // by the basic H and V specified for the component
+      for (y=0; y < z->img_comp[n].v; ++y) {
+         for (x=0; x < z->img_comp[n].h; ++x) {
+            int x2 = (i*z->img_comp[n].h + x)*8;
+            int y2 = (j*z->img_comp[n].v + y)*8;
+            int ha = z->img_comp[n].ha;
+            short *block = data + 64*(x & 1);
+            if (!stbi__jpeg_decode_block(z, block, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+            // blocks side by side in the mcu go through the idct in pairs
+            if (x & 1)
+               stbi__jpeg_idct_pair(z, z->img_comp[n].data+z->img_comp[n].w2*y2+x2-8, z->img_comp[n].w2, data);
+            else if (x+1 == z->img_comp[n].h)
+               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, block);
+         }
+      }
+   }
+   return 1;
+}
+
+// restart intervals of a baseline scan, decoded independently
+typedef struct
+{
+   stbi__jpeg *z;
+   int mcu_w;                // MCUs per row
+   int mcus;                 // MCUs in the scan
+   stbi_uc **start;          // interval k's bytes run from start[k] to start[k+1], its RST marker included
+   const char **failure;     // failure reason of interval k, if it failed
+   int *failed;
+} stbi__jpeg_intervals;
+
+static void stbi__jpeg_decode_intervals(void *data, int first, int last)
+{
+   stbi__jpeg_intervals *g = (stbi__jpeg_intervals *) data;
+   // each run gets its own bit reader and dc predictors, the planes are shared
+   stbi__jpeg z = *g->z;
+   stbi__context s;
+   STBI_SIMD_ALIGN(short, block[128]);
+   int k,m;
+   z.s = &s;
+   for (k=first; k < last; ++k) {
+      int end = (k+1) * z.restart_interval;
+      if (end > g->mcus) end = g->mcus;
+      stbi__start_mem(&s, g->start[k], (int) (g->start[k+1] - g->start[k]));
+      stbi__jpeg_reset(&z);
+      g->failed[k] = 0;
+      for (m=k * z.restart_interval; m < end; ++m) {
+         if (!stbi__jpeg_decode_mcu(&z, block, m % g->mcu_w, m / g->mcu_w)) {
+            g->failure[k] = stbi__g_failure_reason;
+            g->failed[k] = 1;
+            break;
+         }
+      }
+   }
+}
+
+// finds where each restart interval of the scan at the read position starts;
+// returns the scan's end, at its closing marker, or NULL if the scan does not
+// hold exactly count intervals
+static stbi_uc *stbi__jpeg_find_intervals(stbi__context *s, stbi_uc **start, int count)
+{
+   stbi_uc *p = s->img_buffer, *end = s->img_buffer_end;
+   int k = 1;
+   start[0] = p;
+   while (p < end) {
+      stbi_uc *q;
+      if (*p++ != 0xff) continue;
+      q = p;
+      while (q < end && *q == 0xff) ++q; // fill bytes
+      if (q == end) break;
+      if (*q == 0) { p = q+1; continue; } // stuffed zero
+      if (!STBI__RESTART(*q)) {
+         if (k != count) return NULL;
+         start[k] = q+1;
+         return p-1;
+      }
+      if (k == count) return NULL;
+      start[k++] = p = q+1;
+   }
+   if (k != count) return NULL;
+   start[k] = end;
+   return end;
+}
+
+// decodes a baseline scan's restart intervals on stbi__parallel_for; returns
+// -1 when the scan can't be split, leaving the read position untouched
+static int stbi__jpeg_parse_intervals(stbi__jpeg *z)
+{
+   stbi__jpeg_intervals g;
+   stbi_uc *scan_end;
+   int count, k, n = z->order[0];
+   if (!stbi__parallel_for || z->progressive || !z->restart_interval || z->s->read_from_callbacks)
+      return -1;
+   g.z = z;
+   g.mcu_w = z->scan_n == 1 ? (z->img_comp[n].x+7) >> 3 : z->img_mcu_x;
+   g.mcus = z->scan_n == 1 ? g.mcu_w * ((z->img_comp[n].y+7) >> 3) : z->img_mcu_x * z->img_mcu_y;
+   count = (g.mcus + z->restart_interval - 1) / z->restart_interval;
+   if (count < 2) return -1;
+   g.start = (stbi_uc **) stbi__malloc_mad2(count+1, sizeof(stbi_uc *), 0);
+   g.failure = (const char **) stbi__malloc_mad2(count, sizeof(const char *), 0);
+   g.failed = (int *) stbi__malloc_mad2(count, sizeof(int), 0);
+   scan_end = g.start && g.failure && g.failed ? stbi__jpeg_find_intervals(z->s, g.start, count) : NULL;
+   if (scan_end) {
+      stbi__parallel_for(stbi__parallel_user, stbi__jpeg_decode_intervals, &g, count);
+      // continue after the scan as if decoded serially
+      z->s->img_buffer = scan_end;
+      stbi__jpeg_reset(z);
+      for (k=0; k < count; ++k) {
+         if (g.failed[k]) {
+            stbi__g_failure_reason = g.failure[k];
+            break;
+         }
+      }
+   }
+   STBI_FREE(g.start);
+   STBI_FREE(g.failure);
+   STBI_FREE(g.failed);
+   if (!scan_end) return -1;
+   return k == count;
+}
+
 static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
 {
+   int parallel = stbi__jpeg_parse_intervals(z);
+   if (parallel >= 0) return parallel;
    stbi__jpeg_reset(z);
    if (!z->progressive) {
       if (z->scan_n == 1) {
          int i,j;
-         STBI_SIMD_ALIGN(short, data[64]);
+         STBI_SIMD_ALIGN(short, data[128]);
          int n = z->order[0];
          // non-interleaved data, we just need to process one block at a time,
          // in trivial scanline order
@@ -2888,9 +3317,7 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
          int h = (z->img_comp[n].y+7) >> 3;
          for (j=0; j < h; ++j) {
             for (i=0; i < w; ++i) {
-               int ha = z->img_comp[n].ha;
-               if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               if (!stbi__jpeg_decode_mcu(z, data, i, j)) return 0;
                // every data block is an MCU, so countdown the restart interval
                if (--z->todo <= 0) {
                   if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
@@ -2903,25 +3330,11 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
          }
          return 1;
       } else { // interleaved
-         int i,j,k,x,y;
-         STBI_SIMD_ALIGN(short, data[64]);
+         int i,j;
+         STBI_SIMD_ALIGN(short, data[128]);
          for (j=0; j < z->img_mcu_y; ++j) {
             for (i=0; i < z->img_mcu_x; ++i) {
-               // scan an interleaved mcu... process scan_n components in order
-               for (k=0; k < z->scan_n; ++k) {
-                  int n = z->order[k];
-                  // scan out an mcu's worth of this component; that's just determined
-                  // by the basic H and V specified for the component
-                  for (y=0; y < z->img_comp[n].v; ++y) {
-                     for (x=0; x < z->img_comp[n].h; ++x) {
-                        int x2 = (i*z->img_comp[n].h + x)*8;
-                        int y2 = (j*z->img_comp[n].v + y)*8;
-                        int ha = z->img_comp[n].ha;
-                        if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-                        z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
-                     }
-                  }
-               }
+               if (!stbi__jpeg_decode_mcu(z, data, i, j)) return 0;
                // after all interleaved components, that's an interleaved MCU,
                // so now count down the restart interval
                if (--z->todo <= 0) {
@@ -3003,22 +3416,44 @@ static void stbi__jpeg_dequantize(short *data, stbi__uint16 *dequant)
       data[i] *= dequant[i];
 }
 
+// dequantize and idct block rows [first,last) of a progressive jpeg, counting
+// the rows of each component after the previous one's
+static void stbi__jpeg_finish_rows(void *data, int first, int last)
+{
+   stbi__jpeg *z = (stbi__jpeg *) data;
+   int i,j,n,row=0;
+   for (n=0; n < z->s->img_n; ++n) {
+      int w = (z->img_comp[n].x+7) >> 3;
+      int h = (z->img_comp[n].y+7) >> 3;
+      for (j=0; j < h; ++j, ++row) {
+         if (row < first || row >= last) continue;
+         // neighbouring blocks of a row are next to each other in coeff too
+         for (i=0; i < w; i += 2) {
+            short *coeff = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
+            stbi_uc *out = z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8;
+            stbi__jpeg_dequantize(coeff, z->dequant[z->img_comp[n].tq]);
+            if (i+1 < w) {
+               stbi__jpeg_dequantize(coeff+64, z->dequant[z->img_comp[n].tq]);
+               stbi__jpeg_idct_pair(z, out, z->img_comp[n].w2, coeff);
+            } else {
+               z->idct_block_kernel(out, z->img_comp[n].w2, coeff);
+            }
+         }
+      }
+   }
+}
+
 static void stbi__jpeg_finish(stbi__jpeg *z)
 {
    if (z->progressive) {
       // dequantize and idct the data
-      int i,j,n;
-      for (n=0; n < z->s->img_n; ++n) {
-         int w = (z->img_comp[n].x+7) >> 3;
-         int h = (z->img_comp[n].y+7) >> 3;
-         for (j=0; j < h; ++j) {
-            for (i=0; i < w; ++i) {
-               short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
-               stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
-            }
-         }
-      }
+      int n,rows=0;
+      for (n=0; n < z->s->img_n; ++n)
+         rows += (z->img_comp[n].y+7) >> 3;
+      if (stbi__parallel_for)
+         stbi__parallel_for(stbi__parallel_user, stbi__jpeg_finish_rows, z, rows);
+      else
+         stbi__jpeg_finish_rows(z, 0, rows);
    }
 }
 
@@ -3542,6 +3977,78 @@ static stbi_uc *stbi__resample_row_hv_2_simd(stbi_uc *out, stbi_uc *in_near, stb
 }
 #endif
 
+#ifdef STBI_AVX2
+// the sse2 filter on 16 pixels per iteration
+STBI__AVX2_TARGET
+static stbi_uc *stbi__resample_row_hv_2_avx2(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
+{
+   int i=0,t0,t1;
+
+   if (w == 1) {
+      out[0] = out[1] = stbi__div4(3*in_near[0] + in_far[0] + 2);
+      return out;
+   }
+
+   t1 = 3*in_near[0] + in_far[0];
+   for (; i < ((w-1) & ~15); i += 16) {
+      // vertical pass, 3*x + y = 4*x + (y - x)
+      __m256i farw  = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (in_far + i)));
+      __m256i nearw = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (in_near + i)));
+      __m256i diff  = _mm256_sub_epi16(farw, nearw);
+      __m256i nears = _mm256_slli_epi16(nearw, 2);
+      __m256i curr  = _mm256_add_epi16(nears, diff); // current row
+
+      // shift by one pixel across the lanes: alignr shifts within each lane,
+      // the lane permutes bring in the pixel from the other lane
+      __m256i lo0  = _mm256_permute2x128_si256(curr, curr, 0x08); // 0, low lane
+      __m256i hi0  = _mm256_permute2x128_si256(curr, curr, 0x81); // high lane, 0
+      __m256i prv0 = _mm256_alignr_epi8(curr, lo0, 14);
+      __m256i nxt0 = _mm256_alignr_epi8(hi0, curr, 2);
+      __m256i prev = _mm256_insert_epi16(prv0, t1, 0);
+      __m256i next = _mm256_insert_epi16(nxt0, 3*in_near[i+16] + in_far[i+16], 15);
+
+      // horizontal pass, same polyphase filter as the sse2 version
+      __m256i bias = _mm256_set1_epi16(8);
+      __m256i curs = _mm256_slli_epi16(curr, 2);
+      __m256i prvd = _mm256_sub_epi16(prev, curr);
+      __m256i nxtd = _mm256_sub_epi16(next, curr);
+      __m256i curb = _mm256_add_epi16(curs, bias);
+      __m256i even = _mm256_add_epi16(prvd, curb);
+      __m256i odd  = _mm256_add_epi16(nxtd, curb);
+
+      // interleave even and odd pixels, then undo scaling. the lane-wise
+      // unpacks and pack leave pixels 0-7 in the low lane, 8-15 in the high
+      __m256i int0 = _mm256_unpacklo_epi16(even, odd);
+      __m256i int1 = _mm256_unpackhi_epi16(even, odd);
+      __m256i de0  = _mm256_srli_epi16(int0, 4);
+      __m256i de1  = _mm256_srli_epi16(int1, 4);
+
+      // pack and write output
+      __m256i outv = _mm256_packus_epi16(de0, de1);
+      _mm256_storeu_si256((__m256i *) (out + i*2), outv);
+
+      // "previous" value for next iter
+      t1 = 3*in_near[i+15] + in_far[i+15];
+   }
+
+   t0 = t1;
+   t1 = 3*in_near[i] + in_far[i];
+   out[i*2] = stbi__div16(3*t1 + t0 + 8);
+
+   for (++i; i < w; ++i) {
+      t0 = t1;
+      t1 = 3*in_near[i]+in_far[i];
+      out[i*2-1] = stbi__div16(3*t0 + t1 + 8);
+      out[i*2  ] = stbi__div16(3*t1 + t0 + 8);
+   }
+   out[w*2-1] = stbi__div4(t1+2);
+
+   STBI_NOTUSED(hs);
+
+   return out;
+}
+#endif
+
 static stbi_uc *stbi__resample_row_generic(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
 {
    // resample with nearest-neighbor
@@ -3716,10 +4223,78 @@ static void stbi__YCbCr_to_RGB_simd(stbi_uc *out, stbi_uc const *y, stbi_uc cons
 }
 #endif
 
+#ifdef STBI_AVX2
+// the sse2 conversion on 16 pixels per iteration, which finishes the row
+STBI__AVX2_TARGET
+static void stbi__YCbCr_to_RGB_avx2(stbi_uc *out, stbi_uc const *y, stbi_uc const *pcb, stbi_uc const *pcr, int count, int step)
+{
+   int i = 0;
+
+   if (step == 4) {
+      __m128i signflip  = _mm_set1_epi8(-0x80);
+      __m256i cr_const0 = _mm256_set1_epi16(   (short) ( 1.40200f*4096.0f+0.5f));
+      __m256i cr_const1 = _mm256_set1_epi16( - (short) ( 0.71414f*4096.0f+0.5f));
+      __m256i cb_const0 = _mm256_set1_epi16( - (short) ( 0.34414f*4096.0f+0.5f));
+      __m256i cb_const1 = _mm256_set1_epi16(   (short) ( 1.77200f*4096.0f+0.5f));
+      __m256i y_bias = _mm256_set1_epi16(128);
+      __m256i xw = _mm256_set1_epi16(255); // alpha channel
+
+      for (; i+15 < count; i += 16) {
+         // load
+         __m128i y_bytes = _mm_loadu_si128((__m128i *) (y+i));
+         __m128i cr_bytes = _mm_loadu_si128((__m128i *) (pcr+i));
+         __m128i cb_bytes = _mm_loadu_si128((__m128i *) (pcb+i));
+         __m128i cr_biased = _mm_xor_si128(cr_bytes, signflip); // -128
+         __m128i cb_biased = _mm_xor_si128(cb_bytes, signflip); // -128
+
+         // widen to short, the same (y << 8) + 128, cr << 8 and cb << 8 as sse2
+         __m256i yw  = _mm256_or_si256(_mm256_slli_epi16(_mm256_cvtepu8_epi16(y_bytes), 8), y_bias);
+         __m256i crw = _mm256_slli_epi16(_mm256_cvtepu8_epi16(cr_biased), 8);
+         __m256i cbw = _mm256_slli_epi16(_mm256_cvtepu8_epi16(cb_biased), 8);
+
+         // color transform
+         __m256i yws = _mm256_srli_epi16(yw, 4);
+         __m256i cr0 = _mm256_mulhi_epi16(cr_const0, crw);
+         __m256i cb0 = _mm256_mulhi_epi16(cb_const0, cbw);
+         __m256i cb1 = _mm256_mulhi_epi16(cbw, cb_const1);
+         __m256i cr1 = _mm256_mulhi_epi16(crw, cr_const1);
+         __m256i rws = _mm256_add_epi16(cr0, yws);
+         __m256i gwt = _mm256_add_epi16(cb0, yws);
+         __m256i bws = _mm256_add_epi16(yws, cb1);
+         __m256i gws = _mm256_add_epi16(gwt, cr1);
+
+         // descale
+         __m256i rw = _mm256_srai_epi16(rws, 4);
+         __m256i bw = _mm256_srai_epi16(bws, 4);
+         __m256i gw = _mm256_srai_epi16(gws, 4);
+
+         // back to byte, set up for transpose
+         __m256i brb = _mm256_packus_epi16(rw, bw);
+         __m256i gxb = _mm256_packus_epi16(gw, xw);
+
+         // transpose to interleave channels; lane k of o0 has pixels 8k..8k+3,
+         // of o1 pixels 8k+4..8k+7
+         __m256i t0 = _mm256_unpacklo_epi8(brb, gxb);
+         __m256i t1 = _mm256_unpackhi_epi8(brb, gxb);
+         __m256i o0 = _mm256_unpacklo_epi16(t0, t1);
+         __m256i o1 = _mm256_unpackhi_epi16(t0, t1);
+
+         // store
+         _mm256_storeu_si256((__m256i *) (out + 0), _mm256_permute2x128_si256(o0, o1, 0x20));
+         _mm256_storeu_si256((__m256i *) (out + 32), _mm256_permute2x128_si256(o0, o1, 0x31));
+         out += 64;
+      }
+   }
+
+   stbi__YCbCr_to_RGB_simd(out, y+i, pcb+i, pcr+i, count-i, step);
+}
+#endif
+
 // set up the kernels
 static void stbi__setup_jpeg(stbi__jpeg *j)
 {
    j->idct_block_kernel = stbi__idct_block;
+   j->idct_block2_kernel = NULL;
    j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_row;
    j->resample_row_hv_2_kernel = stbi__resample_row_hv_2;
 
@@ -3731,6 +4306,14 @@ static void stbi__setup_jpeg(stbi__jpeg *j)
    }
 #endif
 
+#ifdef STBI_AVX2
+   if (stbi__avx2_available()) {
+      j->idct_block2_kernel = stbi__idct_avx2;
+      j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_avx2;
+      j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_avx2;
+   }
+#endif
+
 #ifdef STBI_NEON
    j->idct_block_kernel = stbi__idct_simd;
    j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_simd;
@@ -3761,69 +4344,54 @@ static stbi_uc stbi__blinn_8x8(stbi_uc x, stbi_uc y)
    return (stbi_uc) ((t + (t >>8)) >> 8);
 }
 
-static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
+// resampling and color conversion of a band of output rows, after decoding
+typedef struct
 {
+   stbi__jpeg *z;
+   stbi_uc *output;
    int n, decode_n, is_rgb;
-   z->s->img_n = 0; // make stbi__cleanup_jpeg safe
-
-   // validate req_comp
-   if (req_comp < 0 || req_comp > 4) return stbi__errpuc("bad req_comp", "Internal error");
-
-   // load a jpeg image from whichever source, but leave in YCbCr format
-   if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return NULL; }
-
-   // determine actual number of components to generate
-   n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
-
-   is_rgb = z->s->img_n == 3 && (z->rgb == 3 || (z->app14_color_transform == 0 && !z->jfif));
-
-   if (z->s->img_n == 3 && n < 3 && !is_rgb)
-      decode_n = 1;
-   else
-      decode_n = z->s->img_n;
-
-   // resample and color-convert
-   {
-      int k;
-      unsigned int i,j;
-      stbi_uc *output;
-      stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
-
+   int band_rows;
+   stbi__resample res_comp[4]; // resampler state at row 0
+   stbi_uc *band_end;          // a row per band: converting writes a byte past a row's end,
+                               // so a band's last row goes through it, not over the next band
+} stbi__jpeg_convert;
+
+// convert bands [first,last), each with its own part of the line buffers
+static void stbi__jpeg_convert_bands(void *data, int first, int last)
+{
+   stbi__jpeg_convert *c = (stbi__jpeg_convert *) data;
+   stbi__jpeg *z = c->z;
+   int n = c->n, decode_n = c->decode_n, is_rgb = c->is_rgb;
+   int k, band;
+   unsigned int i,j;
+   stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
+   for (band=first; band < last; ++band) {
       stbi__resample res_comp[4];
-
+      unsigned int first_row = band * c->band_rows;
+      unsigned int last_row = first_row + c->band_rows;
+      if (first_row >= z->s->img_y) continue;
+      if (last_row > z->s->img_y) last_row = z->s->img_y;
+      // step the resamplers to the band's first row without resampling
       for (k=0; k < decode_n; ++k) {
          stbi__resample *r = &res_comp[k];
-
-         // allocate line buffer big enough for upsampling off the edges
-         // with upsample factor of 4
-         z->img_comp[k].linebuf = (stbi_uc *) stbi__malloc(z->s->img_x + 3);
-         if (!z->img_comp[k].linebuf) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
-
-         r->hs      = z->img_h_max / z->img_comp[k].h;
-         r->vs      = z->img_v_max / z->img_comp[k].v;
-         r->ystep   = r->vs >> 1;
-         r->w_lores = (z->s->img_x + r->hs-1) / r->hs;
-         r->ypos    = 0;
-         r->line0   = r->line1 = z->img_comp[k].data;
-
-         if      (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
-         else if (r->hs == 1 && r->vs == 2) r->resample = stbi__resample_row_v_2;
-         else if (r->hs == 2 && r->vs == 1) r->resample = stbi__resample_row_h_2;
-         else if (r->hs == 2 && r->vs == 2) r->resample = z->resample_row_hv_2_kernel;
-         else                               r->resample = stbi__resample_row_generic;
+         *r = c->res_comp[k];
+         for (j=0; j < first_row; ++j) {
+            if (++r->ystep >= r->vs) {
+               r->ystep = 0;
+               r->line0 = r->line1;
+               if (++r->ypos < z->img_comp[k].y)
+                  r->line1 += z->img_comp[k].w2;
+            }
+         }
       }
-
-      // can't error after this so, this is safe
-      output = (stbi_uc *) stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
-      if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
-
-      // now go ahead and resample
-      for (j=0; j < z->s->img_y; ++j) {
-         stbi_uc *out = output + n * z->s->img_x * j;
+      for (j=first_row; j < last_row; ++j) {
+         stbi_uc *out = c->output + n * z->s->img_x * j;
+         if (j == last_row-1 && last_row < z->s->img_y)
+            out = c->band_end + band * (n * z->s->img_x + 1);
          for (k=0; k < decode_n; ++k) {
             stbi__resample *r = &res_comp[k];
             int y_bot = r->ystep >= (r->vs >> 1);
-            coutput[k] = r->resample(z->img_comp[k].linebuf,
+            coutput[k] = r->resample(z->img_comp[k].linebuf + band * (z->s->img_x + 3),
                                      y_bot ? r->line1 : r->line0,
                                      y_bot ? r->line0 : r->line1,
                                      r->w_lores, r->hs);
@@ -3912,6 +4480,84 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
             }
          }
       }
+      if (last_row < z->s->img_y)
+         memcpy(c->output + n * z->s->img_x * (last_row-1), c->band_end + band * (n * z->s->img_x + 1), n * z->s->img_x);
+   }
+}
+
+static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
+{
+   int n, decode_n, is_rgb;
+   z->s->img_n = 0; // make stbi__cleanup_jpeg safe
+
+   // validate req_comp
+   if (req_comp < 0 || req_comp > 4) return stbi__errpuc("bad req_comp", "Internal error");
+
+   // load a jpeg image from whichever source, but leave in YCbCr format
+   if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return NULL; }
+
+   // determine actual number of components to generate
+   n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
+
+   is_rgb = z->s->img_n == 3 && (z->rgb == 3 || (z->app14_color_transform == 0 && !z->jfif));
+
+   if (z->s->img_n == 3 && n < 3 && !is_rgb)
+      decode_n = 1;
+   else
+      decode_n = z->s->img_n;
+
+   // resample and color-convert
+   {
+      int k, bands;
+      stbi_uc *output;
+      stbi__jpeg_convert c;
+      stbi__resample *res_comp = c.res_comp;
+
+      // bands of at least 32 rows, when there are threads to convert them on
+      bands = stbi__parallel_for ? (z->s->img_y + 31) / 32 : 1;
+      if (bands > 64) bands = 64;
+
+      for (k=0; k < decode_n; ++k) {
+         stbi__resample *r = &res_comp[k];
+
+         // allocate line buffers big enough for upsampling off the edges
+         // with upsample factor of 4, one per band
+         z->img_comp[k].linebuf = (stbi_uc *) stbi__malloc_mad2(bands, z->s->img_x + 3, 0);
+         if (!z->img_comp[k].linebuf) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
+
+         r->hs      = z->img_h_max / z->img_comp[k].h;
+         r->vs      = z->img_v_max / z->img_comp[k].v;
+         r->ystep   = r->vs >> 1;
+         r->w_lores = (z->s->img_x + r->hs-1) / r->hs;
+         r->ypos    = 0;
+         r->line0   = r->line1 = z->img_comp[k].data;
+
+         if      (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
+         else if (r->hs == 1 && r->vs == 2) r->resample = stbi__resample_row_v_2;
+         else if (r->hs == 2 && r->vs == 1) r->resample = stbi__resample_row_h_2;
+         else if (r->hs == 2 && r->vs == 2) r->resample = z->resample_row_hv_2_kernel;
+         else                               r->resample = stbi__resample_row_generic;
+      }
+
+      // can't error after this so, this is safe
+      output = (stbi_uc *) stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
+      if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
+
+      // now go ahead and resample
+      c.z = z;
+      c.output = output;
+      c.n = n;
+      c.decode_n = decode_n;
+      c.is_rgb = is_rgb;
+      c.band_rows = (z->s->img_y + bands - 1) / bands;
+      c.band_end = bands > 1 ? (stbi_uc *) stbi__malloc_mad2(bands, n * z->s->img_x + 1, 0) : NULL;
+      if (c.band_end)
+         stbi__parallel_for(stbi__parallel_user, stbi__jpeg_convert_bands, &c, bands);
+      else {
+         c.band_rows = z->s->img_y;
+         stbi__jpeg_convert_bands(&c, 0, 1);
+      }
+      STBI_FREE(c.band_end);
       stbi__cleanup_jpeg(z);
       *out_x = z->s->img_x;
       *out_y = z->s->img_y;
@@ -3973,13 +4619,19 @@ static int stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp)
 //      - all output is written to a single output buffer (can malloc/realloc)
 //    performance
 //      - fast huffman
+//      - fast loop: 64-bit refills, literal pairs, 8-byte match copies
 
 #ifndef STBI_NO_ZLIB
 
 // fast-way is faster to check than jpeg huffman, but slow way is slower
-#define STBI__ZFAST_BITS  9 // accelerate all cases in default tables
+#define STBI__ZFAST_BITS  11 // accelerate all cases in default tables, and pairs of short literals
 #define STBI__ZFAST_MASK  ((1 << STBI__ZFAST_BITS) - 1)
 
+// the fast loop needs 8 bytes of input for a refill, and room for the longest
+// match plus the 8-byte overrun of its copy
+#define STBI__ZFAST_IN    8
+#define STBI__ZFAST_OUT   (258 + 8)
+
 // zlib-style huffman encoding
 // (jpegs packs from left, zlib from right, so can't share code)
 typedef struct
@@ -4066,7 +4718,7 @@ typedef struct
 {
    stbi_uc *zbuffer, *zbuffer_end;
    int num_bits;
-   stbi__uint32 code_buffer;
+   stbi__uint64 code_buffer;
 
    char *zout;
    char *zout_start;
@@ -4074,8 +4726,13 @@ typedef struct
    int   z_expandable;
 
    stbi__zhuffman z_length, z_distance;
+   stbi__uint32 literal_pairs[1 << STBI__ZFAST_BITS]; // see stbi__zbuild_literal_pairs
 } stbi__zbuf;
 
+// clearing this makes inflate take the careful symbol at a time path only,
+// for comparison in benchmarks
+static int stbi__zlib_fast_loop = 1;
+
 stbi_inline static int stbi__zeof(stbi__zbuf *z)
 {
    return (z->zbuffer >= z->zbuffer_end);
@@ -4089,11 +4746,11 @@ stbi_inline static stbi_uc stbi__zget8(stbi__zbuf *z)
 static void stbi__fill_bits(stbi__zbuf *z)
 {
    do {
-      if (z->code_buffer >= (1U << z->num_bits)) {
+      if (z->code_buffer >= ((stbi__uint64) 1 << z->num_bits)) {
         z->zbuffer = z->zbuffer_end;  /* treat this as EOF so we fail. */
         return;
       }
-      z->code_buffer |= (unsigned int) stbi__zget8(z) << z->num_bits;
+      z->code_buffer |= (stbi__uint64) stbi__zget8(z) << z->num_bits;
       z->num_bits += 8;
    } while (z->num_bits <= 24);
 }
@@ -4102,7 +4759,7 @@ stbi_inline static unsigned int stbi__zreceive(stbi__zbuf *z, int n)
 {
    unsigned int k;
    if (z->num_bits < n) stbi__fill_bits(z);
-   k = z->code_buffer & ((1 << n) - 1);
+   k = (unsigned int) (z->code_buffer & ((1 << n) - 1));
    z->code_buffer >>= n;
    z->num_bits -= n;
    return k;
@@ -4113,7 +4770,7 @@ static int stbi__zhuffman_decode_slowpath(stbi__zbuf *a, stbi__zhuffman *z)
    int b,s,k;
    // not resolved by fast table, so compute it the slow way
    // use jpeg approach, which requires MSbits at top
-   k = stbi__bit_reverse(a->code_buffer, 16);
+   k = stbi__bit_reverse((int) (a->code_buffer & 0xffff), 16);
    for (s=STBI__ZFAST_BITS+1; ; ++s)
       if (k < z->maxcode[s])
          break;
@@ -4146,6 +4803,41 @@ stbi_inline static int stbi__zhuffman_decode(stbi__zbuf *a, stbi__zhuffman *z)
    return stbi__zhuffman_decode_slowpath(a, z);
 }
 
+// tops the bit buffer up to at least 56 bits with a single 8-byte read; needs
+// STBI__ZFAST_IN bytes of input
+stbi_inline static void stbi__zrefill(stbi__zbuf *z)
+{
+   stbi_uc *p = z->zbuffer;
+   // assembled bytewise for any endianness; compilers make it one load
+   stbi__uint64 word = (stbi__uint64) p[0]       | (stbi__uint64) p[1] <<  8 |
+                       (stbi__uint64) p[2] << 16 | (stbi__uint64) p[3] << 24 |
+                       (stbi__uint64) p[4] << 32 | (stbi__uint64) p[5] << 40 |
+                       (stbi__uint64) p[6] << 48 | (stbi__uint64) p[7] << 56;
+   z->code_buffer |= word << z->num_bits;
+   z->zbuffer += (63 - z->num_bits) >> 3;
+   z->num_bits |= 56;
+   // drop the part of the next byte the shift let in, so no bits above
+   // num_bits are set, as the careful path expects
+   z->code_buffer &= ((stbi__uint64) 1 << z->num_bits) - 1;
+}
+
+// literal pairs for the fast loop: entry j holds both literals and their total
+// code length when the bits j start with two literal codes that fit, else 0
+static void stbi__zbuild_literal_pairs(stbi__zbuf *a)
+{
+   int j;
+   for (j=0; j < (1 << STBI__ZFAST_BITS); ++j) {
+      int b1 = a->z_length.fast[j], b2, s;
+      a->literal_pairs[j] = 0;
+      if (!b1 || (b1 & 511) >= 256) continue;
+      s = b1 >> 9;
+      // the code after the first one sits in the top bits, as many as are left
+      b2 = a->z_length.fast[j >> s];
+      if (!b2 || (b2 & 511) >= 256 || s + (b2 >> 9) > STBI__ZFAST_BITS) continue;
+      a->literal_pairs[j] = (stbi__uint32) ((s + (b2 >> 9)) | (b1 & 255) << 8 | (b2 & 255) << 16);
+   }
+}
+
 static int stbi__zexpand(stbi__zbuf *z, char *zout, int n)  // need to make room for n bytes
 {
    char *q;
@@ -4182,11 +4874,108 @@ static const int stbi__zdist_base[32] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129
 static const int stbi__zdist_extra[32] =
 { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
 
+// decodes symbols while there is input for a full refill and room for the
+// longest match, so nothing is checked per symbol: one refill covers a
+// literal pair, or a length and distance with their extra bits. copies move
+// 8 bytes at a time and may write up to 7 bytes past the match. returns 1 at
+// the end of the block, 2 once it runs out of margin, 0 on error
+static int stbi__parse_huffman_fast(stbi__zbuf *a)
+{
+   char *zout = a->zout;
+   int result = 2;
+   while (a->zbuffer_end - a->zbuffer >= STBI__ZFAST_IN && a->zout_end - zout >= STBI__ZFAST_OUT) {
+      stbi__uint32 pair;
+      stbi_uc *p;
+      int z,b,len,dist;
+      stbi__zrefill(a);
+      pair = a->literal_pairs[a->code_buffer & STBI__ZFAST_MASK];
+      if (pair) {
+         zout[0] = (char) (pair >> 8);
+         zout[1] = (char) (pair >> 16);
+         zout += 2;
+         a->code_buffer >>= pair & 255;
+         a->num_bits -= pair & 255;
+         continue;
+      }
+      b = a->z_length.fast[a->code_buffer & STBI__ZFAST_MASK];
+      if (b) {
+         a->code_buffer >>= b >> 9;
+         a->num_bits -= b >> 9;
+         z = b & 511;
+      } else {
+         z = stbi__zhuffman_decode_slowpath(a, &a->z_length);
+      }
+      if (z < 256) {
+         if (z < 0) return stbi__err("bad huffman code","Corrupt PNG"); // error in huffman codes
+         *zout++ = (char) z;
+         continue;
+      }
+      if (z == 256) {
+         result = 1;
+         break;
+      }
+      z -= 257;
+      len = stbi__zlength_base[z];
+      if (stbi__zlength_extra[z]) {
+         len += (int) (a->code_buffer & ((1 << stbi__zlength_extra[z]) - 1));
+         a->code_buffer >>= stbi__zlength_extra[z];
+         a->num_bits -= stbi__zlength_extra[z];
+      }
+      b = a->z_distance.fast[a->code_buffer & STBI__ZFAST_MASK];
+      if (b) {
+         a->code_buffer >>= b >> 9;
+         a->num_bits -= b >> 9;
+         z = b & 511;
+      } else {
+         z = stbi__zhuffman_decode_slowpath(a, &a->z_distance);
+      }
+      if (z < 0) return stbi__err("bad huffman code","Corrupt PNG");
+      dist = stbi__zdist_base[z];
+      if (stbi__zdist_extra[z]) {
+         dist += (int) (a->code_buffer & ((1 << stbi__zdist_extra[z]) - 1));
+         a->code_buffer >>= stbi__zdist_extra[z];
+         a->num_bits -= stbi__zdist_extra[z];
+      }
+      if (zout - a->zout_start < dist) return stbi__err("bad dist","Corrupt PNG");
+      p = (stbi_uc *) (zout - dist);
+      if (dist >= 8) {
+         // 8 bytes back or more, so each 8-byte step only reads finished output
+         char *end = zout + len;
+         do {
+            memcpy(zout, p, 8);
+            zout += 8;
+            p += 8;
+         } while (zout < end);
+         zout = end;
+      } else if (dist == 1) { // run of one byte; common in images.
+         memset(zout, *p, len);
+         zout += len;
+      } else {
+         if (len) { do *zout++ = *p++; while (--len); }
+      }
+   }
+   // give back the whole bytes the refills read ahead, leaving the bit buffer
+   // as the careful path would have it
+   a->zbuffer -= a->num_bits >> 3;
+   a->num_bits &= 7;
+   a->code_buffer &= ((stbi__uint64) 1 << a->num_bits) - 1;
+   a->zout = zout;
+   return result;
+}
+
 static int stbi__parse_huffman_block(stbi__zbuf *a)
 {
    char *zout = a->zout;
    for(;;) {
-      int z = stbi__zhuffman_decode(a, &a->z_length);
+      int z;
+      if (stbi__zlib_fast_loop && a->zbuffer_end - a->zbuffer >= STBI__ZFAST_IN && a->zout_end - zout >= STBI__ZFAST_OUT) {
+         int r;
+         a->zout = zout;
+         r = stbi__parse_huffman_fast(a);
+         if (r != 2) return r;
+         zout = a->zout;
+      }
+      z = stbi__zhuffman_decode(a, &a->z_length);
       if (z < 256) {
          if (z < 0) return stbi__err("bad huffman code","Corrupt PNG"); // error in huffman codes
          if (zout >= a->zout_end) {
@@ -4368,6 +5157,7 @@ static int stbi__parse_zlib(stbi__zbuf *a, int parse_header)
          } else {
             if (!stbi__compute_huffman_codes(a)) return 0;
          }
+         if (stbi__zlib_fast_loop) stbi__zbuild_literal_pairs(a);
          if (!stbi__parse_huffman_block(a)) return 0;
       }
    } while (!final);
@@ -4533,6 +5323,159 @@ static int stbi__paeth(int a, int b, int c)
    return c;
 }
 
+#ifdef STBI_SSE2
+// clearing this makes 8-bit rgb(a) pngs take the scalar filters, for
+// comparison in benchmarks
+static int stbi__png_simd = 1;
+
+// one pixel of bpp (3 or 4) bytes in the low lanes; never reads past it
+stbi_inline static __m128i stbi__png_load_pixel(const stbi_uc *p, int bpp)
+{
+   if (bpp == 4) {
+      int v;
+      memcpy(&v, p, 4);
+      return _mm_cvtsi32_si128(v);
+   }
+   return _mm_cvtsi32_si128(p[0] | p[1] << 8 | p[2] << 16);
+}
+
+stbi_inline static void stbi__png_store_pixel(stbi_uc *p, __m128i v, int bpp)
+{
+   int x = _mm_cvtsi128_si32(v);
+   if (bpp == 4) {
+      memcpy(p, &x, 4);
+   } else {
+      p[0] = (stbi_uc) x;
+      p[1] = (stbi_uc) (x >> 8);
+      p[2] = (stbi_uc) (x >> 16);
+   }
+}
+
+// sse2 defilter of an 8-bit row of n bytes with 3 or 4 byte pixels. prior is
+// the row above, all zeros for the first row, which also stands in for the
+// first-row filters. up works 16 bytes at a time, sub 4 pixels at a time
+// with a prefix sum, avg and paeth a pixel at a time as each one depends on
+// the pixel before it.
+static void stbi__png_defilter_row_simd(int filter, stbi_uc *cur, const stbi_uc *prior, const stbi_uc *raw, int n, int bpp)
+{
+   __m128i zero = _mm_setzero_si128();
+   __m128i a = zero; // pixel to the left, which starts as zeros
+   int k = 0;
+   switch (filter) {
+      case STBI__F_none:
+         memcpy(cur, raw, n);
+         break;
+      case STBI__F_up:
+         for (; k+16 <= n; k += 16) {
+            __m128i x = _mm_loadu_si128((const __m128i *) (raw + k));
+            __m128i b = _mm_loadu_si128((const __m128i *) (prior + k));
+            _mm_storeu_si128((__m128i *) (cur + k), _mm_add_epi8(x, b));
+         }
+         for (; k < n; ++k)
+            cur[k] = STBI__BYTECAST(raw[k] + prior[k]);
+         break;
+      case STBI__F_sub:
+         // a holds the last pixel in all four pixel slots here. the 16-byte
+         // store of 3-byte pixels runs 4 bytes into the next step's pixels
+         for (; k+16 <= n; k += 4*bpp) {
+            __m128i x = _mm_loadu_si128((const __m128i *) (raw + k));
+            x = _mm_add_epi8(x, _mm_slli_si128(x, 4 == bpp ? 4 : 3));
+            x = _mm_add_epi8(x, _mm_slli_si128(x, 4 == bpp ? 8 : 6));
+            x = _mm_add_epi8(x, a);
+            _mm_storeu_si128((__m128i *) (cur + k), x);
+            if (bpp == 4) {
+               a = _mm_shuffle_epi32(x, 0xff);
+            } else {
+               a = _mm_and_si128(_mm_srli_si128(x, 9), _mm_cvtsi32_si128(0xffffff));
+               a = _mm_or_si128(a, _mm_slli_si128(a, 3));
+               a = _mm_or_si128(a, _mm_slli_si128(a, 6));
+            }
+         }
+         for (; k < n; k += bpp) {
+            a = _mm_add_epi8(a, stbi__png_load_pixel(raw + k, bpp));
+            stbi__png_store_pixel(cur + k, a, bpp);
+         }
+         break;
+      case STBI__F_avg: {
+         // floor((a+b)/2) from pavgb's rounded up average
+         __m128i one = _mm_set1_epi8(1);
+         for (; k < n; k += bpp) {
+            __m128i b = stbi__png_load_pixel(prior + k, bpp);
+            __m128i avg = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+            a = _mm_add_epi8(stbi__png_load_pixel(raw + k, bpp), avg);
+            stbi__png_store_pixel(cur + k, a, bpp);
+         }
+         break;
+      }
+      case STBI__F_paeth: {
+         // in 16 bits: p-a = b-c, p-b = a-c, p-c = (b-c)+(a-c); the smallest
+         // distance picks a, then b, then c, the order stbi__paeth breaks ties in
+         __m128i c = zero;
+         for (; k < n; k += bpp) {
+            __m128i b = _mm_unpacklo_epi8(stbi__png_load_pixel(prior + k, bpp), zero);
+            __m128i pa = _mm_sub_epi16(b, c);
+            __m128i pb = _mm_sub_epi16(a, c);
+            __m128i pc = _mm_add_epi16(pa, pb);
+            __m128i smallest, pick_a, pick_b, pred;
+            pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+            pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+            pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+            smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+            pick_a = _mm_cmpeq_epi16(smallest, pa);
+            pick_b = _mm_andnot_si128(pick_a, _mm_cmpeq_epi16(smallest, pb));
+            pred = _mm_or_si128(_mm_and_si128(pick_a, a), _mm_and_si128(pick_b, b));
+            pred = _mm_or_si128(pred, _mm_andnot_si128(_mm_or_si128(pick_a, pick_b), c));
+            pred = _mm_add_epi8(stbi__png_load_pixel(raw + k, bpp), _mm_packus_epi16(pred, zero));
+            stbi__png_store_pixel(cur + k, pred, bpp);
+            a = _mm_unpacklo_epi8(pred, zero);
+            c = b;
+         }
+         break;
+      }
+   }
+}
+
+// defilters an 8-bit rgb or rgba image with the sse2 row filter. rgb that
+// gets an alpha channel added is defiltered in two rows of its own and then
+// widened into the output
+static int stbi__png_defilter_simd(stbi_uc *out, stbi_uc *raw, int img_n, int out_n, stbi__uint32 x, stbi__uint32 y)
+{
+   stbi__uint32 i, j, stride = x*out_n, row_bytes = x*img_n;
+   // a row of zeros above the first row, then the two rows when widening
+   stbi_uc *rows = (stbi_uc *) stbi__malloc_mad2(row_bytes, img_n == out_n ? 1 : 3, 0);
+   if (!rows) return stbi__err("outofmem", "Out of memory");
+   memset(rows, 0, row_bytes);
+   for (j=0; j < y; ++j) {
+      stbi_uc *cur, *prior;
+      int filter = *raw++;
+      if (filter > 4) {
+         STBI_FREE(rows);
+         return stbi__err("invalid filter","Corrupt PNG");
+      }
+      if (img_n == out_n) {
+         cur = out + stride*j;
+         prior = j ? cur - stride : rows;
+      } else {
+         cur = rows + row_bytes*(1 + (j&1));
+         prior = j ? rows + row_bytes*(2 - (j&1)) : rows;
+      }
+      stbi__png_defilter_row_simd(filter, cur, prior, raw, (int) row_bytes, img_n);
+      raw += row_bytes;
+      if (img_n != out_n) {
+         stbi_uc *dest = out + stride*j;
+         for (i=0; i < x; ++i, cur += img_n, dest += out_n) {
+            dest[0] = cur[0];
+            dest[1] = cur[1];
+            dest[2] = cur[2];
+            dest[3] = 255;
+         }
+      }
+   }
+   STBI_FREE(rows);
+   return 1;
+}
+#endif
+
 static const stbi_uc stbi__depth_scale_table[9] = { 0, 0xff, 0x55, 0, 0x11, 0,0,0, 0x01 };
 
 // create the png data from post-deflated data
@@ -4562,6 +5505,11 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
    // so just check for raw_len < img_len always.
    if (raw_len < img_len) return stbi__err("not enough pixels","Corrupt PNG");
 
+#ifdef STBI_SSE2
+   if (stbi__png_simd && depth == 8 && img_n >= 3 && stbi__sse2_available())
+      return stbi__png_defilter_simd(a->out, raw, img_n, out_n, x, y);
+#endif
+
    for (j=0; j < y; ++j) {
       stbi_uc *cur = a->out + stride*j;
       stbi_uc *prior;
@@ -1,71 +1,379 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
 #include <cmath>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <thread>
 #include <vector>
 #include "glad/glad.h"
 #include <GLFW/glfw3.h>
 #define STB_IMAGE_IMPLEMENTATION
 #include "include/stb_image.h"
+// Only the declarations again for the headers below
+#undef STB_IMAGE_IMPLEMENTATION
 #include "glm/glm.hpp"
 #include "glm/gtc/matrix_transform.hpp"
 #include "glm/gtc/type_ptr.hpp"
+#include "gridgen.hpp"
+#include "griddata.hpp"
+#include "gridtiles.hpp"
+#include "gridlod.hpp"
+#include "gridgpu.hpp"
+#include "texturestream.hpp"
+#include "streambuffer.hpp"
+#include "glstate.hpp"
+#include "renderqueue.hpp"
+#include "drawcommands.hpp"
+#include "framepackets.hpp"
+#include "vertexformat.hpp"
+#include "profiler.hpp"
+#include "shader.hpp"
+#include "shaderreload.hpp"
 
 #define SCREEN_HEIGHT 800
 #define SCREEN_WIDTH 800
 
 void framebufferSizeCallback(GLFWwindow* window, int width, int height);
 void windowCloseCallback(GLFWwindow* window);
-void processInput(GLFWwindow* window);
-void writeRect(int shaderProgram, int gridSize);
-
-const char* vertexShaderSource = 
-	"#version 330 core\n"
-	"layout (location = 0) in vec3 aPos;\n"
-	"layout (location = 1) in vec3 aColor;\n"
-	// "layout (location = 2) in vec2 aTexCoord;\n"
-	"out vec3 color;\n"
-	// "out vec2 texCoord;\n"
-	"uniform mat4 transform;\n"
-	"void main(){\n"
-	"	gl_Position = transform * vec4(aPos, 1.0);\n"
-	"	color = aColor;\n"
-	// "	texCoord = vec2(aTexCoord.x, aTexCoord.y);\n"
-	"}\n"
-;
-
-const char* fragmentShaderSource =
-	"#version 330 core\n"
-	"in vec3 color;\n"
-	"in vec2 texCoord;\n"
-	"out vec4 FragColor;\n"
-	"uniform sampler2D texture;\n"
-	"void main(){\n"
-	"	FragColor = vec4(color, 1.0f);\n"
-	// "	FragColor = texture(texture, texCoord);\n"
-	"}\n"
-;
-
-unsigned int VAO, VBO, EBO;
+void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods);
+void remapGrid(bool regenerate, bool recolor, unsigned int seed, int gridSize);
+void renderLoop(GLFWwindow* window, Shader* gridShader, ShaderReloader* shaderReloader, int gridSize);
+void expandGrid(int gridSize);
+void writeRect(int gridSize);
+void writeInstances(int gridSize);
+bool continueUpload();
+void setInstancePointers(size_t offset);
+void recolorCells(int count);
+void recolorCells(GridData* data, int count);
+void submitSpans(RenderPacket packet, const std::vector<GridSpan>& spans, Uniform<int> cellBaseUniform);
+void submitLod(RenderPacket packet, const glm::mat4& viewProjection, int viewportWidth, int viewportHeight);
+void drawGrid(const void* payload);
+void drawSpans(const GridSpan* spans, size_t count);
+void addSpanCommands(const GridSpan* spans, size_t count);
+void drawLod(const void* payload);
+void benchmarkRemap(int gridSize);
+void benchmarkStartup(ProgramCache* cache, const char* directory, const char** vertexShaders, const char** defines, int count);
+void benchmarkDraws(Shader* gridShader, int gridSize);
+void benchmarkGpuGrid(int gridSize);
+void benchmarkDecode();
+void benchmarkJpegKernels();
+void benchmarkPng();
+
+// Grid shaders are read from here at startup, CMake points it at the source tree
+#ifndef SHADER_DIR
+#define SHADER_DIR "shaders"
+#endif
+
+enum GridMode{
+	GRID_MODE_EXPANDED,		// 4 vertices in a VertexFormat + 6 indices per cell (writeRect)
+	GRID_MODE_INSTANCED,	// 1 shared quad + 8 byte instance per cell (writeInstances)
+	GRID_MODE_PROCEDURAL,	// 8 byte instance per cell read from a buffer texture, no vertex or index data
+	GRID_MODE_LOD,			// colors in a mip pyramid, quadtree nodes drawn at a level picked per frame (drawLod)
+	GRID_MODE_COUNT
+};
+
+// Per-cell data is streamed through a ring of regions so remaps never reallocate or stall.
+// Each region has its own VAO, attribute pointers are set once at startup.
+unsigned int VAO[StreamBuffer::MAX_REGIONS], EBO;
+StreamBuffer* vertexStream;
+unsigned int instanceVAO[StreamBuffer::MAX_REGIONS], quadVBO, quadEBO;
+StreamBuffer* instanceStream;
+unsigned int proceduralVAO, cellTexture;
+
+GridMode gridMode = GRID_MODE_INSTANCED;
+VertexFormat vertexFormat = VERTEX_FORMAT_PACKED;
+// Expanded grid only: 16-bit indices, drawn in chunks of GRID_CHUNK_CELLS with a base vertex
+bool shortIndices = 0;
+
+// Grid generation runs on a worker pool; colors are a function of the seed, bumped on every F2
+GridWorkers* gridWorkers;
+unsigned int gridSeed = 1;
+
+// CPU copy of the grid; uploads only carry the spans a stream region has not seen yet
+GridData* gridData;
+std::vector<GridSpan> dirtySpans;
+// Expanded grid only: gridData's cells expanded to vertices by the remap job, so uploads are
+// plain copies. Kept up to date as the GridData target after the stream regions.
+char* gridVertices;
+std::vector<GridSpan> vertexSpans;
+// Whole uploads made on the GPU from the seed (--gpu-grid), NULL makes them on the CPU
+GridGenerator* gridGenerator;
+
+// Upload of a remap into the next region of its stream, at most remapBytesPerFrame a frame.
+// Draws keep reading the last region until the whole remap is in.
+struct GridUpload{
+	// NULL when nothing is left to copy
+	StreamBuffer* stream;
+	const char* source;
+	size_t cellBytes;
+	// Cells still to copy, from spans[next] on
+	std::vector<GridSpan> spans;
+	size_t next;
+};
+GridUpload gridUpload;
+const size_t remapBytesPerFrame = 16*1024*1024;
+
+// Images or texbake texture files drawn on the expanded grid (--texture), loaded while the grid already renders.
+// F6 cycles through them; a texture still loading shows the streamer's placeholder.
+TextureStreamer* textureStreamer;
+std::vector<const char*> texturePaths;
+int shownTexture = 0;
+
+// Tiles outside the view are culled on the CPU; the rest are drawn as spans of cells
+GridTiles* gridTiles;
+std::vector<GridSpan> visibleSpans;
+bool culling = 1;
+
+// Level of detail grid, replaces gridData and the cell streams. Nodes are picked so a quad
+// covers at most lodPixels pixels and are streamed as instances.
+GridLod* gridLod;
+StreamBuffer* nodeStream;
+unsigned int lodVAO[StreamBuffer::MAX_REGIONS];
+std::vector<GridLodNode> lodNodes;
+float lodPixels = 1.0f;
+
+// Grid units to clip space, = and - zoom
+float viewScale = 0.05f;
+
+// Per-span draw parameters for the multi-draw calls in drawSpans
+std::vector<GLsizei> drawCounts;
+std::vector<GLint> drawFirsts;
+
+// Indexed grid draws, one per span or chunk, handed to GL the drawSubmit way
+DrawCommands* drawCommands;
+DrawSubmit drawSubmit = DRAW_SUBMIT_INDIRECT;
+
+// Headless: offscreen OSMesa context, a fixed number of frames into a framebuffer object, then exit
+bool headless = 0;
+int headlessFrames = 100;
+
+// Draws of a frame are submitted as packets and executed together, sorted by state
+RenderQueue* renderQueue;
+
+// The main thread pumps events and runs the simulation, the render thread owns the GL
+// context. Every frame the main thread publishes a packet the render thread draws, or
+// overwrites the last one while the render thread is busy; remaps run on a thread of
+// their own and ride the packet of the frame they finish in.
+struct FramePacket{
+	glm::mat4 transform;
+	GLenum polygonMode;
+	int viewportWidth, viewportHeight;
+	// A remap finished: upload it, and print its time since remapStart when report is set
+	bool upload;
+	bool report;
+	bool rerun;
+	double remapStart;
+	// Handle of the texture to draw the grid with
+	int texture;
+	// Milliseconds the main thread spent on events for this packet and the ones it overwrote
+	double inputTime;
+};
+FramePackets<FramePacket> framePackets;
+// Remaps the render thread has uploaded. The next remap starts once the last one is in, so
+// remaps and uploads never touch the grid at the same time.
+std::atomic<int> remapsUploaded(0);
+GLenum polygonMode = GL_FILL;
+int framebufferWidth = SCREEN_WIDTH;
+int framebufferHeight = SCREEN_HEIGHT;
+
+// Frame phase and GPU timings, dumped to profilePath on exit when set
+Profiler* profiler;
+const char* profilePath = NULL;
 
 bool rerun = 1;
+bool recolor = 0;
 bool rotate = 0;
+bool streaming = 0;
+
+int main(int argc, char** argv){
+	int gridSize = 1000;
+	int threadCount = (int)std::thread::hardware_concurrency();
+	bool benchmark = 0;
+	bool startupBenchmark = 0;
+	bool drawBenchmark = 0;
+	bool gpuGrid = 0;
+	bool gpuGridBenchmark = 0;
+	bool decodeBenchmark = 0;
+	bool jpegKernelBenchmark = 0;
+	bool pngBenchmark = 0;
+	// Linked programs are cached here between runs, NULL disables it
+	const char* shaderCachePath = "shadercache";
+	const char* shaderDirectory = SHADER_DIR;
+	// Rebuild programs when their files change
+	bool hotReload = 1;
+
+	for(int i = 1; i < argc; i++){
+		if(strcmp(argv[i], "--mode") == 0 && i+1 < argc){
+			i++;
+			if(strcmp(argv[i], "expanded") == 0){
+				gridMode = GRID_MODE_EXPANDED;
+			}
+			else if(strcmp(argv[i], "instanced") == 0){
+				gridMode = GRID_MODE_INSTANCED;
+			}
+			else if(strcmp(argv[i], "procedural") == 0){
+				gridMode = GRID_MODE_PROCEDURAL;
+			}
+			else if(strcmp(argv[i], "lod") == 0){
+				gridMode = GRID_MODE_LOD;
+			}
+			else{
+				printf("Unknown grid mode '%s' (expected expanded, instanced, procedural or lod)\n", argv[i]);
+				return -1;
+			}
+		}
+		else if(strcmp(argv[i], "--indices") == 0 && i+1 < argc){
+			i++;
+			if(strcmp(argv[i], "uint") == 0){
+				shortIndices = 0;
+			}
+			else if(strcmp(argv[i], "ushort") == 0){
+				shortIndices = 1;
+			}
+			else{
+				printf("Unknown index type '%s' (expected uint or ushort)\n", argv[i]);
+				return -1;
+			}
+		}
+		else if(strcmp(argv[i], "--format") == 0 && i+1 < argc){
+			vertexFormat = vertexFormatFromName(argv[++i]);
+			if(vertexFormat == VERTEX_FORMAT_COUNT){
+				printf("Unknown vertex format '%s' (expected float, packed, packed-uv or vertexid)\n", argv[i]);
+				return -1;
+			}
+		}
+		else if(strcmp(argv[i], "--grid-size") == 0 && i+1 < argc){
+			gridSize = atoi(argv[++i]);
+			// Packed corners store x+1 in 16 bits
+			if(gridSize <= 0 || gridSize > 65534){
+				printf("Grid size must be between 1 and 65534\n");
+				return -1;
+			}
+		}
+		else if(strcmp(argv[i], "--scale") == 0 && i+1 < argc){
+			viewScale = (float)atof(argv[++i]);
+		}
+		else if(strcmp(argv[i], "--lod-pixels") == 0 && i+1 < argc){
+			lodPixels = (float)atof(argv[++i]);
+		}
+		else if(strcmp(argv[i], "--threads") == 0 && i+1 < argc){
+			threadCount = atoi(argv[++i]);
+		}
+		else if(strcmp(argv[i], "--stream") == 0){
+			streaming = 1;
+		}
+		else if(strcmp(argv[i], "--no-cull") == 0){
+			culling = 0;
+		}
+		else if(strcmp(argv[i], "--gpu-grid") == 0){
+			gpuGrid = 1;
+		}
+		else if(strcmp(argv[i], "--texture") == 0 && i+1 < argc){
+			texturePaths.push_back(argv[++i]);
+		}
+		else if(strcmp(argv[i], "--headless") == 0){
+			headless = 1;
+		}
+		else if(strcmp(argv[i], "--frames") == 0 && i+1 < argc){
+			headlessFrames = atoi(argv[++i]);
+		}
+		else if(strcmp(argv[i], "--profile") == 0 && i+1 < argc){
+			profilePath = argv[++i];
+		}
+		else if(strcmp(argv[i], "--shader-dir") == 0 && i+1 < argc){
+			shaderDirectory = argv[++i];
+		}
+		else if(strcmp(argv[i], "--no-hot-reload") == 0){
+			hotReload = 0;
+		}
+		else if(strcmp(argv[i], "--shader-cache") == 0 && i+1 < argc){
+			shaderCachePath = argv[++i];
+		}
+		else if(strcmp(argv[i], "--no-shader-cache") == 0){
+			shaderCachePath = NULL;
+		}
+		else if(strcmp(argv[i], "--bench-remap") == 0){
+			benchmark = 1;
+		}
+		else if(strcmp(argv[i], "--submit") == 0 && i+1 < argc){
+			drawSubmit = drawSubmitFromName(argv[++i]);
+			if(drawSubmit == DRAW_SUBMIT_COUNT){
+				printf("Unknown draw submission '%s' (expected indirect, multi or loop)\n", argv[i]);
+				return -1;
+			}
+		}
+		else if(strcmp(argv[i], "--bench-startup") == 0){
+			startupBenchmark = 1;
+		}
+		else if(strcmp(argv[i], "--bench-draws") == 0){
+			drawBenchmark = 1;
+		}
+		else if(strcmp(argv[i], "--bench-gpu-grid") == 0){
+			gpuGridBenchmark = 1;
+		}
+		else if(strcmp(argv[i], "--bench-decode") == 0){
+			decodeBenchmark = 1;
+		}
+		else if(strcmp(argv[i], "--bench-jpeg-kernels") == 0){
+			jpegKernelBenchmark = 1;
+		}
+		else if(strcmp(argv[i], "--bench-png") == 0){
+			pngBenchmark = 1;
+		}
+		else{
+			printf("Usage: %s [--mode expanded|instanced|procedural|lod] [--format float|packed|packed-uv|vertexid] [--indices uint|ushort] [--grid-size N] [--scale S] [--lod-pixels P] [--threads N] [--stream] [--no-cull] [--gpu-grid] [--texture PATH]... [--submit indirect|multi|loop] [--headless] [--frames N] [--profile out.json|out.csv] [--shader-dir DIR] [--no-hot-reload] [--shader-cache DIR] [--no-shader-cache] [--bench-remap] [--bench-startup] [--bench-draws] [--bench-gpu-grid] [--bench-decode] [--bench-jpeg-kernels] [--bench-png]\n", argv[0]);
+			return -1;
+		}
+	}
+
+	if(benchmark){
+		benchmarkRemap(gridSize);
+		return 0;
+	}
+	if(decodeBenchmark){
+		benchmarkDecode();
+		return 0;
+	}
+	if(jpegKernelBenchmark){
+		benchmarkJpegKernels();
+		return 0;
+	}
+	if(pngBenchmark){
+		benchmarkPng();
+		return 0;
+	}
+
+	gridWorkers = new GridWorkers(threadCount);
 
-int main(){
-	glfwInit();
+	if(!glfwInit()){
+		printf("Failed to initialize GLFW\n");
+		return -1;
+	}
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 #ifdef __APPLE__
 	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);   
 #endif
+	// OSMesa renders in software into memory. Without an X server, configure with -DGLFW_USE_OSMESA=ON
+	// so GLFW uses its null platform, which needs no display at all.
+	if(headless){
+		glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	}
 	
 	GLFWwindow* window = glfwCreateWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "LearnOpenGL", NULL, NULL);
 	if(window == NULL){
-		printf("Failed to create GLFW window");
+		printf(headless ? "Failed to create OSMesa context (is libOSMesa installed?)\n" : "Failed to create GLFW window");
 		glfwTerminate();
 		return -1;
 	}
 	glfwMakeContextCurrent(window);
-	glfwSwapInterval(1);
+	glfwSwapInterval(headless ? 0 : 1);
 
 	if(!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)){
 		printf("Failed to initialize GLAD");
@@ -74,61 +382,88 @@ int main(){
 	}
 	glViewport(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
 	// glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+
+	profiler = new Profiler();
+	if(profilePath){
+		profiler->enable();
+	}
+	renderQueue = new RenderQueue();
+	drawCommands = new DrawCommands();
+	if(!DrawCommands::supported(drawSubmit)){
+		printf("No ARB_multi_draw_indirect, submitting draws with %s\n", drawSubmitNames[DRAW_SUBMIT_MULTI]);
+	}
+
+	// Offscreen Framebuffer, bound for the whole run in headless mode
+	unsigned int offscreenFBO = 0, offscreenColor = 0;
+	if(headless){
+		glGenFramebuffers(1, &offscreenFBO);
+		glGenRenderbuffers(1, &offscreenColor);
+		glBindRenderbuffer(GL_RENDERBUFFER, offscreenColor);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, SCREEN_WIDTH, SCREEN_HEIGHT);
+		glBindFramebuffer(GL_FRAMEBUFFER, offscreenFBO);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, offscreenColor);
+		if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE){
+			printf("Offscreen framebuffer incomplete\n");
+			glfwTerminate();
+			return -1;
+		}
+		printf("Headless: %s, %d frames\n", glGetString(GL_RENDERER), headlessFrames);
+	}
 	
 	// Callbacks
 	glfwSetFramebufferSizeCallback(window, framebufferSizeCallback);
 	glfwSetWindowCloseCallback(window, windowCloseCallback);
+	glfwSetKeyCallback(window, keyCallback);
 
-	// OpenGL Erorr Variables
-	int shaderSuccess;
-	char infoLog[512];
-
-	// OpenGL Vertex Shader
-	unsigned int vertexShader;
-	vertexShader = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(vertexShader, 1, &vertexShaderSource, NULL);
-	glCompileShader(vertexShader);
-
-	glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &shaderSuccess);
-	if(!shaderSuccess){
-		glGetShaderInfoLog(vertexShader, 512, NULL, infoLog);
-		printf("ERROR::SHADER::VERTEX::COMPILATION_FAILED\n%s", infoLog);
-		glfwTerminate();
-		return -1;
+	// Shader Programs, one per grid mode, all with grid.fs
+	const char* gridVertexShaders[GRID_MODE_COUNT] = {vertexFormats[vertexFormat].vertexShader, "instanced.vs", "procedural.vs", "lod.vs"};
+	if(!texturePaths.empty() && (gridMode != GRID_MODE_EXPANDED || !vertexFormats[vertexFormat].vertexShaderDefines)){
+		printf("Textures need the expanded grid with texture coordinates (--format float or packed-uv), drawing without\n");
+		texturePaths.clear();
 	}
-
-	// OpenGL Fragment Shader
-	unsigned int fragmentShader;
-	fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(fragmentShader, 1, &fragmentShaderSource, NULL);
-	glCompileShader(fragmentShader);
-
-	glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &shaderSuccess);
-	if(!shaderSuccess){
-		glGetShaderInfoLog(fragmentShader, 512, NULL, infoLog);
-		printf("ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n%s", infoLog);
+	std::string expandedDefines = vertexFormats[vertexFormat].vertexShaderDefines ? vertexFormats[vertexFormat].vertexShaderDefines : "";
+	if(!texturePaths.empty()){
+		expandedDefines += ",TEXTURE";
+	}
+	const char* gridShaderDefines[GRID_MODE_COUNT] = {expandedDefines.empty() ? NULL : expandedDefines.c_str(), NULL, NULL, NULL};
+	ProgramCache* programCache = shaderCachePath ? new ProgramCache(shaderCachePath) : NULL;
+	if(startupBenchmark){
+		benchmarkStartup(programCache, shaderDirectory, gridVertexShaders, gridShaderDefines, GRID_MODE_COUNT);
+		delete programCache;
 		glfwTerminate();
-		return -1;
+		return 0;
 	}
-
-	// Shader Linking
-	unsigned int shaderProgram;
-	shaderProgram = glCreateProgram();
-
-	glAttachShader(shaderProgram, vertexShader);
-	glAttachShader(shaderProgram, fragmentShader);
-	glLinkProgram(shaderProgram);
-
-	glGetProgramiv(shaderProgram, GL_LINK_STATUS, &shaderSuccess);
-	if(!shaderSuccess){
-		glGetProgramInfoLog(shaderProgram, 512, NULL, infoLog);
-		printf("ERROR::SHADER::PROGRAM::LINKING_FAILED\n%s", infoLog);
+	ShaderVariants* shaderVariants = new ShaderVariants(shaderDirectory, programCache);
+	Shader* gridShaders[GRID_MODE_COUNT];
+	bool shadersBuilt = true;
+	double shaderStart = glfwGetTime();
+	for(int i = 0; i < GRID_MODE_COUNT; i++){
+		gridShaders[i] = shaderVariants->get(gridVertexShaders[i], "grid.fs", gridShaderDefines[i]);
+		shadersBuilt = shadersBuilt && gridShaders[i];
+		// GLSL 330 has no binding layout qualifier, the blocks are bound here and again on reload
+		if(gridShaders[i]){
+			gridShaders[i]->bindBlock("FrameBlock", RENDER_FRAME_BINDING);
+			gridShaders[i]->bindBlock("ObjectBlock", RENDER_OBJECT_BINDING);
+		}
+	}
+	if(!shadersBuilt){
 		glfwTerminate();
 		return -1;
 	}
-
-	glDeleteShader(vertexShader);
-	glDeleteShader(fragmentShader);
+	printf("Built %d shader programs in %.2f ms (%d from cache)\n", GRID_MODE_COUNT, (glfwGetTime() - shaderStart)*1000.0, programCache ? programCache->hits : 0);
+	Shader* gridShader = gridShaders[gridMode];
+
+	// Reloads build on a hidden window's context
+	GLFWwindow* shaderContext = NULL;
+	if(hotReload){
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+		shaderContext = glfwCreateWindow(1, 1, "Shader compiler", NULL, window);
+	}
+	ShaderReloader* shaderReloader = hotReload ? new ShaderReloader(shaderVariants, shaderContext) : NULL;
+	if(vertexFormat == VERTEX_FORMAT_VERTEXID){
+		gridShaders[GRID_MODE_EXPANDED]->use();
+		gridShaders[GRID_MODE_EXPANDED]->setInt("gridSize", gridSize);
+	}
 
 	// // Graphics Data
 	// float vertices[] = {
@@ -144,89 +479,217 @@ int main(){
 	// };
 
 
-	int gridSize = 1000;
-
 	// // Vertex Objects
 	// unsigned int VAO, VBO, EBO;
 
-	glGenVertexArrays(1, &VAO);
-	glGenBuffers(1, &VBO);
 	glGenBuffers(1, &EBO);
-
-	// // OpenGL Object
-	glBindVertexArray(VAO);
-	
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, gridSize*gridSize*4*8*sizeof(float), NULL, GL_STATIC_DRAW);
-
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, gridSize*gridSize*6*sizeof(unsigned int), NULL, GL_STATIC_DRAW);
+	if(gridMode == GRID_MODE_EXPANDED){
+		vertexStream = new StreamBuffer(GL_ARRAY_BUFFER, (size_t)gridSize*gridSize*4*vertexFormats[vertexFormat].stride);
+		printf("Vertex stream: %s, %s format (%d bytes per vertex)\n", vertexStream->persistent() ? "persistent mapped" : "unsynchronized maps",
+			vertexFormats[vertexFormat].name, vertexFormats[vertexFormat].stride);
+
+		// // OpenGL Object
+		glGenVertexArrays(vertexStream->regions(), VAO);
+		for(int i = 0; i < vertexStream->regions(); i++){
+			glState().bindVertexArray(VAO[i]);
+			glState().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+			glState().bindBuffer(GL_ARRAY_BUFFER, vertexStream->ID);
+			enableVertexFormat(vertexFormat);
+			setVertexFormat(vertexFormat, vertexStream->size()*i);
+		}
+	}
 	
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3*sizeof(float)));
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-	glEnableVertexAttribArray(2);
-
-	// // OpenGL Texture
-	// unsigned int texture;
-	// glGenTextures(1, &texture);
-	// glBindTexture(GL_TEXTURE_2D, texture);
-
-	// // Texture Wrapping
-	// glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
-	// glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
-
-	// // Texture Filtering
-	// glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	// glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-	// // Load Image
-	// int width, height, nrChannels;
-	// unsigned char* data = stbi_load("../wall.jpg", &width, &height, &nrChannels, 0);
-	// if(data){
-	// 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-	// 	glGenerateMipmap(GL_TEXTURE_2D);
-	// }
-	// else{
-	// 	printf("Failed to load texture");
-	// }
-	// stbi_image_free(data);
-
-	glBindVertexArray(0);
+	// The index pattern only depends on gridSize, write it once
+	if(gridMode == GRID_MODE_EXPANDED && shortIndices){
+		// One chunk's worth of indices, shared by every chunk
+		std::vector<unsigned short> chunkIndices(GRID_CHUNK_CELLS*6);
+		generateChunkIndices(chunkIndices.data(), GRID_CHUNK_CELLS);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, chunkIndices.size()*sizeof(unsigned short), chunkIndices.data(), GL_STATIC_DRAW);
+	}
+	else if(gridMode == GRID_MODE_EXPANDED){
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, gridSize*gridSize*6*sizeof(unsigned int), NULL, GL_STATIC_DRAW);
+		unsigned int* indicesPtr = (unsigned int*)glMapBufferRange(GL_ELEMENT_ARRAY_BUFFER, 0, gridSize*gridSize*6*sizeof(unsigned int), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		gridWorkers->run(gridSize, [=](int firstRow, int lastRow){
+			generateIndexRows(indicesPtr, gridSize, firstRow, lastRow);
+		});
+		glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
+	}
 
-	// writeRect(shaderProgram, gridSize);
+	// Textures: decoded on worker threads and uploaded a slice a frame, the grid draws meanwhile
+	if(!texturePaths.empty()){
+		textureStreamer = new TextureStreamer(threadCount);
+		for(size_t i = 0; i < texturePaths.size(); i++){
+			textureStreamer->load(texturePaths[i]);
+		}
+		gridShader->use();
+		gridShader->setInt("image", 0);
+	}
 
-	float timeOld = 0;
-	float timeValue = 0;
+	// Instanced Grid Objects
+	float quadVertices[] = {
+		0.5f, 0.5f,
+		0.5f, -0.5f,
+		-0.5f, -0.5f,
+		-0.5f, 0.5f
+	};
+	unsigned int quadIndices[] = {
+		0, 1, 3,
+		1, 2, 3
+	};
+
+	glGenBuffers(1, &quadVBO);
+	glGenBuffers(1, &quadEBO);
+
+	glState().bindBuffer(GL_ARRAY_BUFFER, quadVBO);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), quadVertices, GL_STATIC_DRAW);
+	// No VAO is bound to hold an element array binding yet
+	glState().bindBuffer(GL_COPY_WRITE_BUFFER, quadEBO);
+	glBufferData(GL_COPY_WRITE_BUFFER, sizeof(quadIndices), quadIndices, GL_STATIC_DRAW);
+
+	if(gridMode == GRID_MODE_INSTANCED || gridMode == GRID_MODE_PROCEDURAL){
+		instanceStream = new StreamBuffer(GL_ARRAY_BUFFER, gridSize*gridSize*sizeof(GridInstance));
+		printf("Instance stream: %s\n", instanceStream->persistent() ? "persistent mapped" : "unsynchronized maps");
+	}
+	if(gridMode == GRID_MODE_INSTANCED){
+		glGenVertexArrays(instanceStream->regions(), instanceVAO);
+		for(int i = 0; i < instanceStream->regions(); i++){
+			glState().bindVertexArray(instanceVAO[i]);
+			glState().bindBuffer(GL_ARRAY_BUFFER, quadVBO);
+			glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+			glEnableVertexAttribArray(0);
+			glState().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, quadEBO);
+
+			glState().bindBuffer(GL_ARRAY_BUFFER, instanceStream->ID);
+			setInstancePointers(instanceStream->size()*i);
+			glEnableVertexAttribArray(1);
+			glVertexAttribDivisor(1, 1);
+			glEnableVertexAttribArray(2);
+			glVertexAttribDivisor(2, 1);
+		}
+	}
+	if(gridMode != GRID_MODE_LOD){
+		gridData = new GridData(gridSize, gridMode == GRID_MODE_EXPANDED ? vertexStream->regions() + 1 : instanceStream->regions());
+	}
+	if(gridMode == GRID_MODE_EXPANDED){
+		gridVertices = (char*)malloc((size_t)gridSize*gridSize*4*vertexFormats[vertexFormat].stride);
+	}
+	if((gpuGrid || gpuGridBenchmark) && gridMode == GRID_MODE_LOD){
+		printf("GPU grid generation does not cover the level of detail grid, generating on the CPU\n");
+	}
+	else if(gpuGrid || gpuGridBenchmark){
+		gridGenerator = new GridGenerator((std::string(shaderDirectory) + "/gridgen.vs").c_str(), gridSize, gridMode == GRID_MODE_EXPANDED, vertexFormat);
+		if(!gridGenerator->valid()){
+			printf("GPU grid generation failed to build, generating on the CPU\n");
+			delete gridGenerator;
+			gridGenerator = NULL;
+		}
+	}
+	gridTiles = new GridTiles(gridSize);
+
+	// Procedural Grid Objects: an empty VAO and a buffer texture over the instance stream
+	glGenVertexArrays(1, &proceduralVAO);
+	glGenTextures(1, &cellTexture);
+	if(gridMode == GRID_MODE_PROCEDURAL){
+		int maxTexels;
+		glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+		if((size_t)maxTexels < instanceStream->size()*instanceStream->regions()/sizeof(GridInstance)){
+			printf("Grid too large for a buffer texture (%d texels max)\n", maxTexels);
+			glfwTerminate();
+			return -1;
+		}
+		glState().bindTexture(0, GL_TEXTURE_BUFFER, cellTexture);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32UI, instanceStream->ID);
+		gridShader->use();
+		gridShader->setInt("cells", 0);
+	}
 
-	// Render Loop
-	while(!glfwWindowShouldClose(window)){
-		// Input Handler
-		processInput(window);
+	// Level of Detail Grid Objects: the color pyramid and a stream of quadtree nodes as instances
+	if(gridMode == GRID_MODE_LOD){
+		int maxTextureSize;
+		glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+		if(GridLod::paddedSize(gridSize) > maxTextureSize){
+			printf("Grid too large for a level of detail texture (%d texels per side max)\n", maxTextureSize);
+			glfwTerminate();
+			return -1;
+		}
+		gridLod = new GridLod(gridSize);
+		printf("Level of detail: %d levels, %d x %d texture\n", gridLod->levelCount, GridLod::paddedSize(gridSize), GridLod::paddedSize(gridSize));
+
+		// Drawn nodes never overlap, so there are at most as many as level 0 tiles
+		nodeStream = new StreamBuffer(GL_ARRAY_BUFFER, (size_t)gridLod->tilesPerSide(0)*gridLod->tilesPerSide(0)*sizeof(GridLodNode));
+		glGenVertexArrays(nodeStream->regions(), lodVAO);
+		for(int i = 0; i < nodeStream->regions(); i++){
+			glState().bindVertexArray(lodVAO[i]);
+			glState().bindBuffer(GL_ARRAY_BUFFER, nodeStream->ID);
+			glVertexAttribIPointer(1, 3, GL_UNSIGNED_SHORT, sizeof(GridLodNode), (void*)(nodeStream->size()*i));
+			glEnableVertexAttribArray(1);
+			glVertexAttribDivisor(1, 1);
+		}
 
-		// Render
-		glClearColor(0.1f, 0.1f, 0.33f, 1.0f);
-		glClear(GL_COLOR_BUFFER_BIT);
+		gridShader->use();
+		gridShader->setInt("colors", 0);
+		gridShader->setInt("gridSize", gridSize);
+		gridShader->setInt("tileSize", gridLod->tileSize);
+	}
 
-		timeOld = timeValue;
-		timeValue = glfwGetTime();
+	// writeRect(shaderProgram, gridSize);
 
-		glUseProgram(shaderProgram);
+	if(drawBenchmark){
+		benchmarkDraws(gridShader, gridSize);
+		glfwTerminate();
+		return 0;
+	}
+	if(gpuGridBenchmark){
+		benchmarkGpuGrid(gridSize);
+		glfwTerminate();
+		return 0;
+	}
 
-		
+	// The render thread holds the context until it exits
+	glfwMakeContextCurrent(NULL);
+	std::thread renderThread(renderLoop, window, gridShader, shaderReloader, gridSize);
+
+	// Simulation: one remap at a time, off both the main and the render thread
+	std::future<void> remapJob;
+	int remapsFinished = 0;
+	double remapStart = 0;
+	bool remapReport = false;
+	bool remapRerun = false;
+	int frame = 0;
+	double loopStart = glfwGetTime();
+
+	// Main Loop
+	while(!glfwWindowShouldClose(window) && !(headless && frame >= headlessFrames)){
+		// Input Handler: keys arrive through keyCallback
+		double inputStart = glfwGetTime();
+		glfwPollEvents();
+		double inputTime = (glfwGetTime() - inputStart)*1000.0;
 
-		if(rerun){
-			printf("Remapping graphics data...\n");
-			writeRect(shaderProgram, gridSize);
+		bool upload = false;
+		if(remapJob.valid() && remapJob.wait_for(std::chrono::seconds(0)) == std::future_status::ready){
+			remapJob.get();
+			remapsFinished++;
+			upload = true;
+		}
+		if(!remapJob.valid() && remapsUploaded == remapsFinished && (rerun || streaming || recolor)){
+			remapStart = glfwGetTime();
+			if(streaming){
+				gridSeed++;
+			}
+			else if(rerun){
+				printf("Remapping graphics data...\n");
+			}
+			bool regenerate = rerun || streaming;
+			bool recolorGrid = recolor;
+			unsigned int seed = gridSeed;
+			remapJob = std::async(std::launch::async, [=]{
+				remapGrid(regenerate, recolorGrid, seed, gridSize);
+			});
+			remapReport = !streaming;
+			remapRerun = rerun;
 			rerun = 0;
+			recolor = 0;
 		}
-		
-		glBindVertexArray(VAO);
-
-		// glBindTexture(GL_TEXTURE_2D, texture);
-
 
 		glm::mat4 trans = glm::mat4(1.0f);
 		if(rotate){
@@ -234,129 +697,1111 @@ int main(){
 			trans = glm::rotate(trans, glm::radians(-60.0f), glm::vec3(1.0f, 1.0f, 0.0f));
 		}
 		trans = glm::translate(trans, glm::vec3(-1.0f, -1.0f, 0.0f));
-		trans = glm::scale(trans, glm::vec3(0.05f, 0.05f, 0.0f));
-
-		unsigned int transformLoc = glGetUniformLocation(shaderProgram, "transform");
-		glUniformMatrix4fv(transformLoc, 1, GL_FALSE, glm::value_ptr(trans));
-
-		glDrawElements(GL_TRIANGLES, 6*gridSize*gridSize, GL_UNSIGNED_INT, 0);
+		trans = glm::scale(trans, glm::vec3(viewScale, viewScale, 0.0f));
+
+		// While the render thread is a frame behind, the packet it has not taken yet is
+		// overwritten; a finished remap and the input time carry over to the new one
+		bool stale;
+		FramePacket& packet = framePackets.write(stale);
+		packet.transform = trans;
+		packet.polygonMode = polygonMode;
+		packet.viewportWidth = framebufferWidth;
+		packet.viewportHeight = framebufferHeight;
+		packet.upload = upload || (stale && packet.upload);
+		packet.report = remapReport;
+		packet.rerun = remapRerun;
+		packet.remapStart = remapStart;
+		packet.texture = shownTexture;
+		packet.inputTime = stale ? packet.inputTime + inputTime : inputTime;
+		framePackets.publish();
+		if(!stale){
+			frame++;
+		}
+		// Handles events again after a while even when the render thread is still busy
+		framePackets.wait(std::chrono::milliseconds(4));
+	}
 
+	framePackets.close();
+	renderThread.join();
+	if(remapJob.valid()){
+		remapJob.wait();
+	}
+	glfwMakeContextCurrent(window);
 
-		// Events and Swap
-		glfwSwapBuffers(window);
-		glfwPollEvents();
+	if(profilePath){
+		profiler->printSummary();
+		profiler->dump(profilePath);
+	}
 
-		// printf("%f\n", 1/(timeValue - timeOld));
-		glBindVertexArray(0);
+	if(headless){
+		glFinish();
+		double elapsed = glfwGetTime() - loopStart;
+		printf("Rendered %d frames in %.2f ms (%.3f ms per frame)\n", frame, elapsed*1000.0, frame ? elapsed*1000.0/frame : 0.0);
+		glDeleteRenderbuffers(1, &offscreenColor);
+		glDeleteFramebuffers(1, &offscreenFBO);
 	}
 
+	delete vertexStream;
+	delete instanceStream;
+	delete gridData;
+	free(gridVertices);
+	delete gridGenerator;
+	delete gridTiles;
+	delete textureStreamer;
+	delete gridLod;
+	delete nodeStream;
+	delete profiler;
+	delete renderQueue;
+	delete shaderReloader;
+	if(shaderContext){
+		glfwDestroyWindow(shaderContext);
+	}
+	delete shaderVariants;
+	delete programCache;
 	glfwTerminate();
+	delete gridWorkers;
 	return 0;
 }
 
-void framebufferSizeCallback(GLFWwindow* window, int width, int height){
-	glViewport(0, 0, width, height);
+// The render thread applies the size with the next packet
+void framebufferSizeCallback(GLFWwindow*, int width, int height){
+	framebufferWidth = width;
+	framebufferHeight = height;
 }
 
 void windowCloseCallback(GLFWwindow* window){
 	glfwSetWindowShouldClose(window, GLFW_TRUE);
 }
 
-bool polymode = 0;
-int counterPolymode = 0;
-int counterRotate = 0;
+// Render thread: draws the packets the main thread publishes until it closes them
+void renderLoop(GLFWwindow* window, Shader* gridShader, ShaderReloader* shaderReloader, int gridSize){
+	glfwMakeContextCurrent(window);
+
+	// Per-draw uniforms, looked up once; the transforms are in RenderQueue's uniform blocks
+	Uniform<int> cellBaseUniform = gridShader->uniform<int>("cellBase");
+
+	int viewportWidth = SCREEN_WIDTH;
+	int viewportHeight = SCREEN_HEIGHT;
+	// The grid is drawn once its first remap is uploaded
+	bool gridReady = false;
+	// Packet of the remap being uploaded while uploading is set
+	bool uploading = false;
+	FramePacket remap;
+	int frame = 0;
+	// State calls add up over the loop, printed per frame once it exits
+	glState().resetCounts();
+	// Culling results of the frames that drew tiles, printed the same way
+	int tileFrames = 0;
+	double tilesDrawn = 0, tilesCulled = 0, tileSpans = 0;
+	// Nodes of the frames that drew the level of detail grid, and the finest and coarsest levels seen
+	int lodFrames = 0;
+	double lodDrawn = 0, lodCulled = 0;
+	int lodFinest = 0, lodCoarsest = -1;
 
-void processInput(GLFWwindow* window){
-	if(glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS){
-		windowCloseCallback(window);
-	}
+	// Render Loop
+	while(FramePacket* next = framePackets.read()){
+		FramePacket packet = *next;
+		framePackets.release();
+		profiler->beginFrame();
+
+		profiler->add(PROFILER_INPUT, packet.inputTime);
+
+		// Finished shader reloads and the view of the packet
+		profiler->begin(PROFILER_RELOAD);
+		if(shaderReloader && shaderReloader->poll()){
+			// Locations may differ in the new program
+			cellBaseUniform = gridShader->uniform<int>("cellBase");
+		}
+		if(packet.viewportWidth != viewportWidth || packet.viewportHeight != viewportHeight){
+			viewportWidth = packet.viewportWidth;
+			viewportHeight = packet.viewportHeight;
+			glViewport(0, 0, viewportWidth, viewportHeight);
+		}
+		glState().polygonMode(packet.polygonMode);
+		profiler->end();
 
-	if(glfwGetKey(window, GLFW_KEY_F1) == GLFW_PRESS){
-		counterPolymode++;
-		if(polymode && counterPolymode == 1){
-			glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-			polymode = !polymode;
+		// Render
+		profiler->beginGpu();
+		profiler->begin(PROFILER_REMAP);
+		if(packet.upload){
+			if(gridMode == GRID_MODE_LOD){
+				gridLod->update();
+			}
+			else if(gridMode == GRID_MODE_EXPANDED){
+				writeRect(gridSize);
+			}
+			else{
+				writeInstances(gridSize);
+			}
+			remap = packet;
+			uploading = true;
+		}
+		if(uploading && continueUpload()){
+			if(remap.report){
+				printf("%s %d cells in %.2f ms\n", remap.rerun ? "Remapped" : "Recolored", remap.rerun ? gridSize*gridSize : gridSize*gridSize/100, (glfwGetTime() - remap.remapStart)*1000.0);
+			}
+			remapsUploaded++;
+			gridReady = true;
+			uploading = false;
 		}
-		else if(!polymode  && counterPolymode == 1){
-			glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-			polymode = !polymode;
+		if(textureStreamer){
+			textureStreamer->update();
+		}
+		profiler->end();
+		
+		profiler->begin(PROFILER_UNIFORMS);
+
+		// State shared by the grid packets, the submit functions fill in the rest
+		// The packet's transform is the whole view, the grid itself sits at the origin
+		FrameUniforms frameUniforms;
+		frameUniforms.viewProjection = packet.transform;
+		frameUniforms.time = (float)glfwGetTime();
+		renderQueue->beginFrame(frameUniforms);
+		RenderPacket grid;
+		grid.program = gridShader->ID;
+		grid.vertexArray = 0;
+		grid.textureTarget = 0;
+		grid.texture = 0;
+		if(textureStreamer){
+			grid.textureTarget = GL_TEXTURE_2D;
+			grid.texture = textureStreamer->texture(packet.texture);
 		}
+		grid.object.model = glm::mat4(1.0f);
+		profiler->end();
+
+		profiler->begin(PROFILER_DRAW);
+		glClearColor(0.1f, 0.1f, 0.33f, 1.0f);
+		glClear(GL_COLOR_BUFFER_BIT);
+		if(gridReady && gridMode == GRID_MODE_LOD){
+			submitLod(grid, packet.transform, viewportWidth, viewportHeight);
+			if(gridLod->drawn){
+				lodFinest = lodCoarsest < 0 ? gridLod->finestLevel : std::min(lodFinest, gridLod->finestLevel);
+				lodCoarsest = std::max(lodCoarsest, gridLod->coarsestLevel);
+			}
+			lodFrames++;
+			lodDrawn += gridLod->drawn;
+			lodCulled += gridLod->culled;
+			renderQueue->execute();
+			nodeStream->fence();
+		}
+		else if(gridReady){
+			// Culling
+			if(culling){
+				gridTiles->cull(packet.transform, visibleSpans);
+			}
+			else{
+				gridTiles->all(visibleSpans);
+			}
+			tileFrames++;
+			tilesDrawn += gridTiles->drawn;
+			tilesCulled += gridTiles->culled;
+			tileSpans += visibleSpans.size();
+
+			submitSpans(grid, visibleSpans, cellBaseUniform);
+			renderQueue->execute();
+			if(gridMode == GRID_MODE_EXPANDED){
+				vertexStream->fence();
+			}
+			else{
+				instanceStream->fence();
+			}
+		}
+		else{
+			// Nothing to draw, still hands the frame's uniform region back
+			renderQueue->execute();
+		}
+		profiler->end();
+		profiler->endGpu();
+
+
+		// Swap
+		profiler->begin(PROFILER_SWAP);
+		glfwSwapBuffers(window);
+		profiler->end();
+
+		profiler->endFrame();
+		if(frame == 0){
+			printf("First frame %.2f ms after startup\n", glfwGetTime()*1000.0);
+		}
+		frame++;
+	}
+	if(frame){
+		glState().printCounts(frame);
+	}
+	if(tileFrames){
+		printf("Tiles per frame over %d frames: %.1f drawn, %.1f culled (%.1f spans)\n", tileFrames, tilesDrawn/tileFrames, tilesCulled/tileFrames, tileSpans/tileFrames);
 	}
-	if(glfwGetKey(window, GLFW_KEY_F1) == GLFW_RELEASE){
-		counterPolymode = 0;
+	if(lodFrames){
+		printf("LOD nodes per frame over %d frames: %.1f drawn, %.1f culled, levels %d to %d\n", lodFrames, lodDrawn/lodFrames, lodCulled/lodFrames, lodFinest, std::max(lodCoarsest, 0));
 	}
+	glfwMakeContextCurrent(NULL);
+}
 
-	if(glfwGetKey(window, GLFW_KEY_F2) == GLFW_PRESS){
-		rerun = 1;
+// Remap thread: regenerates and recolors the CPU copy of the grid and prepares it for the
+// render thread, which only copies it
+void remapGrid(bool regenerate, bool recolor, unsigned int seed, int gridSize){
+	if(regenerate && gridMode == GRID_MODE_LOD){
+		gridLod->generate(gridWorkers, seed);
+	}
+	else if(regenerate && gridGenerator){
+		gridData->reseed(seed);
+	}
+	else if(regenerate){
+		gridData->generate(gridWorkers, seed);
 	}
+	if(recolor){
+		recolorCells(gridSize*gridSize/100);
+	}
+	if(gridMode == GRID_MODE_LOD){
+		gridLod->build(gridWorkers);
+	}
+	else if(gridMode == GRID_MODE_EXPANDED){
+		expandGrid(gridSize);
+	}
+}
 
-	if(glfwGetKey(window, GLFW_KEY_F3) == GLFW_PRESS){
-		counterRotate++;
-		if(rotate && counterRotate == 1){
+// Main thread, from glfwPollEvents: keys act once per press, so presses between two polls are not lost
+void keyCallback(GLFWwindow* window, int key, int, int action, int){
+	// F2 remaps again for as long as it is held
+	if(key == GLFW_KEY_F2 && action != GLFW_RELEASE){
+		rerun = 1;
+		gridSeed++;
+	}
+	if(action != GLFW_PRESS){
+		return;
+	}
+	switch(key){
+		case GLFW_KEY_ESCAPE:
+			windowCloseCallback(window);
+			break;
+		case GLFW_KEY_F1:
+			polygonMode = polygonMode == GL_FILL ? GL_LINE : GL_FILL;
+			break;
+		case GLFW_KEY_F3:
 			rotate = !rotate;
+			break;
+		// F4 toggles regenerating the grid every frame
+		case GLFW_KEY_F4:
+			streaming = !streaming;
+			break;
+		// = and - zoom in and out
+		case GLFW_KEY_EQUAL:
+			viewScale *= 2.0f;
+			break;
+		case GLFW_KEY_MINUS:
+			viewScale *= 0.5f;
+			break;
+		// F5 recolors 1% of the cells and uploads only those
+		case GLFW_KEY_F5:
+			recolor = 1;
+			break;
+		// F6 shows the next --texture
+		case GLFW_KEY_F6:
+			if(!texturePaths.empty()){
+				shownTexture = (shownTexture + 1) % (int)texturePaths.size();
+			}
+			break;
+	}
+}
+
+// Remap thread: brings gridVertices up to date with gridData, whole or the spans changed since.
+// Whole grids the GPU makes from the seed need no vertices.
+void expandGrid(int gridSize){
+	if(gridGenerator && gridData->seeded()){
+		return;
+	}
+	bool whole = gridData->takeDirty(vertexStream->regions(), vertexSpans);
+	char* vertices = gridVertices;
+	const GridInstance* cells = gridData->cells.data();
+	if(whole){
+		gridWorkers->run(gridSize, [=](int firstRow, int lastRow){
+			expandVertices(vertexFormat, vertices, cells, (size_t)gridSize*firstRow, (size_t)gridSize*lastRow);
+		});
+	}
+	else{
+		for(size_t i = 0; i < vertexSpans.size(); i++){
+			expandVertices(vertexFormat, vertices, cells, vertexSpans[i].first, vertexSpans[i].last);
 		}
-		else if(!rotate  && counterRotate == 1){
-			rotate = !rotate;
+	}
+}
+
+// Starts copying the cells of source, cellBytes each, that the next region of stream has not seen yet.
+// whole copies every cell, spans the changed ones otherwise.
+void beginUpload(StreamBuffer* stream, const void* source, size_t cellBytes, bool whole, int gridSize){
+	if(whole){
+		GridSpan all = {0, (unsigned int)gridSize*gridSize};
+		gridUpload.spans.assign(1, all);
+	}
+	gridUpload.stream = stream;
+	gridUpload.source = (const char*)source;
+	gridUpload.cellBytes = cellBytes;
+	gridUpload.next = 0;
+	stream->beginCopy();
+}
+
+void writeRect(int gridSize){
+	bool whole = gridData->takeDirty(vertexStream->nextRegion(), gridUpload.spans);
+	if(whole && gridGenerator && gridData->seeded()){
+		gridGenerator->generate(vertexStream, gridData->seed);
+		return;
+	}
+	beginUpload(vertexStream, gridVertices, 4*vertexFormats[vertexFormat].stride, whole, gridSize);
+}
+
+void writeInstances(int gridSize){
+	bool whole = gridData->takeDirty(instanceStream->nextRegion(), gridUpload.spans);
+	if(whole && gridGenerator && gridData->seeded()){
+		gridGenerator->generate(instanceStream, gridData->seed);
+		return;
+	}
+	beginUpload(instanceStream, gridData->cells.data(), sizeof(GridInstance), whole, gridSize);
+}
+
+// Copies the next remapBytesPerFrame of the upload writeRect() or writeInstances() started.
+// True once the region is current, or when nothing was left to copy.
+bool continueUpload(){
+	if(!gridUpload.stream){
+		return true;
+	}
+	size_t cells = remapBytesPerFrame/gridUpload.cellBytes;
+	while(gridUpload.next < gridUpload.spans.size() && cells > 0){
+		GridSpan& span = gridUpload.spans[gridUpload.next];
+		size_t count = std::min((size_t)(span.last - span.first), cells);
+		size_t offset = span.first*gridUpload.cellBytes;
+		gridUpload.stream->copy(offset, gridUpload.source + offset, count*gridUpload.cellBytes);
+		span.first += (unsigned int)count;
+		cells -= count;
+		if(span.first == span.last){
+			gridUpload.next++;
 		}
 	}
-	if(glfwGetKey(window, GLFW_KEY_F3) == GLFW_RELEASE){
-		counterRotate = 0;
+	if(gridUpload.next < gridUpload.spans.size()){
+		return false;
 	}
+	gridUpload.stream->endCopy();
+	gridUpload.stream = NULL;
+	return true;
 }
 
-void writeRect(int shaderProgram, int gridSize){
-	glBindVertexArray(VAO);
-	// char *verticesPtr = (char*)glMapBufferRange(GL_ARRAY_BUFFER, 0, (sizeof(float)*8*4*gridSize*gridSize), GL_MAP_WRITE_BIT);
-	// char *indicesPtr = (char*)glMapBufferRange(GL_ELEMENT_ARRAY_BUFFER, 0, (sizeof(int))*6*gridSize*gridSize, GL_MAP_WRITE_BIT);
+// Instance attributes of the bound VAO, reading GL_ARRAY_BUFFER from offset
+void setInstancePointers(size_t offset){
+	glVertexAttribPointer(1, 2, GL_UNSIGNED_SHORT, GL_FALSE, sizeof(GridInstance), (void*)(offset + offsetof(GridInstance, x)));
+	glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(GridInstance), (void*)(offset + offsetof(GridInstance, color)));
+}
 
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glDeleteBuffers(1, &VBO);
+// Payload of a grid packet, followed in the arena by count spans
+struct GridDraw{
+	Uniform<int> cellBaseUniform;
+	int cellBase;
+	size_t count;
+};
+
+// Queues the cells of spans as one packet with the grid VAO of the current stream region
+void submitSpans(RenderPacket packet, const std::vector<GridSpan>& spans, Uniform<int> cellBaseUniform){
+	if(spans.empty()){
+		return;
+	}
+	if(gridMode == GRID_MODE_INSTANCED){
+		packet.vertexArray = instanceVAO[instanceStream->region()];
+	}
+	else if(gridMode == GRID_MODE_PROCEDURAL){
+		packet.vertexArray = proceduralVAO;
+		packet.textureTarget = GL_TEXTURE_BUFFER;
+		packet.texture = cellTexture;
+	}
+	else{
+		packet.vertexArray = VAO[vertexStream->region()];
+	}
+	packet.draw = drawGrid;
+	GridDraw* draw = (GridDraw*)renderQueue->submit(packet, 0.0f, sizeof(GridDraw) + spans.size()*sizeof(GridSpan));
+	draw->cellBaseUniform = cellBaseUniform;
+	draw->cellBase = gridMode == GRID_MODE_PROCEDURAL ? (int)(instanceStream->offset()/sizeof(GridInstance)) : 0;
+	draw->count = spans.size();
+	memcpy(draw + 1, spans.data(), spans.size()*sizeof(GridSpan));
+}
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-	glDeleteBuffers(1, &EBO);
+void drawGrid(const void* payload){
+	const GridDraw* draw = (const GridDraw*)payload;
+	if(gridMode == GRID_MODE_PROCEDURAL){
+		uniformUpload(draw->cellBaseUniform.location, &draw->cellBase, 1);
+	}
+	drawSpans((const GridSpan*)(draw + 1), draw->count);
+}
 
-	glGenBuffers(1, &VBO);
-	glGenBuffers(1, &EBO);
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, gridSize*gridSize*4*8*sizeof(float), NULL, GL_STATIC_DRAW);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, gridSize*gridSize*6*sizeof(unsigned int), NULL, GL_STATIC_DRAW);
+// Draws the cells of spans with the bound grid VAO and program
+void drawSpans(const GridSpan* spans, size_t count){
+	if(gridMode == GRID_MODE_INSTANCED && !GLAD_GL_ARB_base_instance){
+		// No base instance before GL 4.2, start the instance attributes at the span instead
+		size_t offset = instanceStream->offset();
+		for(size_t i = 0; i < count; i++){
+			glState().bindBuffer(GL_ARRAY_BUFFER, instanceStream->ID);
+			setInstancePointers(offset + spans[i].first*sizeof(GridInstance));
+			glDrawElementsInstanced(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0, spans[i].last - spans[i].first);
+		}
+		if(count){
+			setInstancePointers(offset);
+		}
+	}
+	else if(gridMode == GRID_MODE_PROCEDURAL){
+		drawCounts.clear();
+		drawFirsts.clear();
+		for(size_t i = 0; i < count; i++){
+			drawFirsts.push_back(6*spans[i].first);
+			drawCounts.push_back(6*(spans[i].last - spans[i].first));
+		}
+		glMultiDrawArrays(GL_TRIANGLES, drawFirsts.data(), drawCounts.data(), (GLsizei)drawCounts.size());
+	}
+	else{
+		drawCommands->clear();
+		addSpanCommands(spans, count);
+		drawCommands->submit(GL_TRIANGLES, gridMode == GRID_MODE_EXPANDED && shortIndices ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, drawSubmit);
+	}
+}
+
+// Appends a draw command per span to drawCommands, instanced spans start at their first cell's instance
+void addSpanCommands(const GridSpan* spans, size_t count){
+	for(size_t i = 0; i < count; i++){
+		if(gridMode == GRID_MODE_INSTANCED){
+			drawCommands->add(6, 0, 0, spans[i].last - spans[i].first, spans[i].first);
+		}
+		else if(shortIndices){
+			// Spans are split at chunk boundaries, every chunk starts at index 0 with its own base vertex
+			unsigned int first = spans[i].first;
+			while(first < spans[i].last){
+				unsigned int chunk = first/GRID_CHUNK_CELLS;
+				unsigned int chunkEnd = (chunk + 1)*GRID_CHUNK_CELLS;
+				unsigned int last = spans[i].last < chunkEnd ? spans[i].last : chunkEnd;
+				drawCommands->add(6*(last - first), 6*(first - chunk*GRID_CHUNK_CELLS), chunk*GRID_CHUNK_CELLS*4);
+				first = last;
+			}
+		}
+		else{
+			drawCommands->add(6*(spans[i].last - spans[i].first), 6*spans[i].first, 0);
+		}
+	}
+}
+
+// Picks the quadtree nodes seen through viewProjection, streams them and queues them as instances of one tile of quads
+void submitLod(RenderPacket packet, const glm::mat4& viewProjection, int viewportWidth, int viewportHeight){
+	gridLod->select(viewProjection*packet.object.model, viewportWidth, viewportHeight, lodPixels, lodNodes);
+	if(lodNodes.empty()){
+		return;
+	}
+
+	memcpy(nodeStream->beginWrite(), lodNodes.data(), lodNodes.size()*sizeof(GridLodNode));
+	nodeStream->endWrite();
+
+	packet.vertexArray = lodVAO[nodeStream->region()];
+	packet.textureTarget = GL_TEXTURE_2D;
+	packet.texture = gridLod->texture;
+	packet.draw = drawLod;
+	GLsizei* instances = (GLsizei*)renderQueue->submit(packet, 0.0f, sizeof(GLsizei));
+	*instances = (GLsizei)lodNodes.size();
+}
+
+// Payload is the node count
+void drawLod(const void* payload){
+	glDrawArraysInstanced(GL_TRIANGLES, 0, 6*gridLod->tileSize*gridLod->tileSize, *(const GLsizei*)payload);
+}
+
+// Seed of the last recolorCells() pass
+unsigned int recolorSeed = 0;
+// Cells are recolored in runs of consecutive cells, each run one word of GridData's dirty
+// bits and whole cache lines of the copy. Lone cells cost a cache miss and a span each.
+const int RECOLOR_RUN = 64;
+
+// Gives count cells of grid, a GridData or GridLod, new colors in runs at pseudo-random places
+template<typename Grid>
+void recolorRuns(Grid* grid, int gridSize, int count){
+	recolorSeed++;
+	unsigned int cells = (unsigned int)gridSize*gridSize;
+	unsigned int runs = (cells + RECOLOR_RUN - 1)/RECOLOR_RUN;
+	int i = 0;
+	for(unsigned int run = 0; i < count; run++){
+		unsigned int cell = gridHash(recolorSeed, run) % runs*RECOLOR_RUN;
+		for(int k = 0; k < RECOLOR_RUN && cell < cells && i < count; k++, cell++, i++){
+			grid->setColor(cell % gridSize, cell / gridSize, gridColor(recolorSeed ^ 0x5bd1e995u, i));
+		}
+	}
+}
+
+// Gives count cells of the grid being drawn a new color
+void recolorCells(int count){
+	if(gridMode != GRID_MODE_LOD){
+		recolorCells(gridData, count);
+		return;
+	}
+	recolorRuns(gridLod, gridLod->gridSize, count);
+}
+
+// The same on data alone, whatever the grid mode; benchmarkRemap has no level of detail grid
+void recolorCells(GridData* data, int count){
+	data->materialize(gridWorkers);
+	recolorRuns(data, data->gridSize, count);
+}
+
+// CPU-only remap throughput for both grid modes across thread counts, no GL context needed
+void benchmarkRemap(int gridSize){
+	size_t cells = (size_t)gridSize*gridSize;
+	std::vector<float> vertices(cells*32);
+	std::vector<GridInstance> instances(cells);
+	int maxThreads = (int)std::thread::hardware_concurrency();
+	if(maxThreads < 1){
+		maxThreads = 1;
+	}
+	const int passes = 5;
+	auto seconds = [&](std::function<void(int)> pass){
+		auto start = std::chrono::steady_clock::now();
+		for(int i = 0; i < passes; i++){
+			pass(i);
+		}
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()/passes;
+	};
+
+	printf("Remap benchmark, %dx%d grid, expanded %s format (%d bytes per vertex)\n", gridSize, gridSize, vertexFormats[vertexFormat].name, vertexFormats[vertexFormat].stride);
+	for(int threads = 1; ; threads *= 2){
+		if(threads > maxThreads){
+			threads = maxThreads;
+		}
+		GridWorkers workers(threads);
+
+		double instancedTime = seconds([&](int pass){
+			workers.run(gridSize, [&](int firstRow, int lastRow){
+				generateInstanceRows(instances.data(), gridSize, firstRow, lastRow, pass);
+			});
+		});
+		double expandedTime = seconds([&](int){
+			workers.run(gridSize, [&](int firstRow, int lastRow){
+				expandVertices(vertexFormat, vertices.data(), instances.data(), (size_t)gridSize*firstRow, (size_t)gridSize*lastRow);
+			});
+		});
+
+		printf("%2d threads: generate %8.2f ms %7.1f Mcells/s | expand %8.2f ms %7.1f Mcells/s\n",
+			threads, instancedTime*1000.0, cells/instancedTime/1e6, expandedTime*1000.0, cells/expandedTime/1e6);
+
+		if(threads == maxThreads){
+			break;
+		}
+	}
+
+	// Full remap versus changing 1% of the cells, uploaded into stand-ins for one stream region
+	GridWorkers workers(maxThreads);
+	gridWorkers = &workers;
+	gridData = new GridData(gridSize, 1);
+	std::vector<GridInstance> region(cells);
+	auto upload = [&](bool expanded){
+		const GridInstance* source = gridData->cells.data();
+		if(gridData->takeDirty(0, dirtySpans)){
+			workers.run(gridSize, [&](int firstRow, int lastRow){
+				size_t first = (size_t)gridSize*firstRow;
+				size_t last = (size_t)gridSize*lastRow;
+				if(expanded){
+					expandVertices(vertexFormat, vertices.data(), source, first, last);
+				}
+				else{
+					memcpy(region.data() + first, source + first, (last - first)*sizeof(GridInstance));
+				}
+			});
+			return;
+		}
+		for(size_t i = 0; i < dirtySpans.size(); i++){
+			if(expanded){
+				expandVertices(vertexFormat, vertices.data(), source, dirtySpans[i].first, dirtySpans[i].last);
+			}
+			else{
+				memcpy(region.data() + dirtySpans[i].first, source + dirtySpans[i].first, (dirtySpans[i].last - dirtySpans[i].first)*sizeof(GridInstance));
+			}
+		}
+	};
+
+	for(int expanded = 0; expanded < 2; expanded++){
+		double fullTime = seconds([&](int pass){
+			gridData->generate(&workers, pass);
+			upload(expanded);
+		});
+		double scatteredTime = seconds([&](int){
+			recolorCells(gridData, gridSize*gridSize/100);
+			upload(expanded);
+		});
+		double rowsTime = seconds([&](int pass){
+			for(int y = 0; y < (gridSize + 99)/100; y++){
+				for(int x = 0; x < gridSize; x++){
+					gridData->setColor(x, y, gridColor(pass, y*gridSize + x));
+				}
+			}
+			upload(expanded);
+		});
+		printf("%s: full remap %8.3f ms | 1%% in runs of %d cells %7.3f ms (%.1f%%) | 1%% of rows %7.3f ms (%.1f%%)\n",
+			expanded ? "expanded " : "instanced", fullTime*1000.0, RECOLOR_RUN, scatteredTime*1000.0, scatteredTime/fullTime*100.0, rowsTime*1000.0, rowsTime/fullTime*100.0);
+	}
 
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3*sizeof(float)));
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
+	delete gridData;
+	gridData = NULL;
+	gridWorkers = NULL;
+}
+
+bool readFileBytes(const char* path, std::vector<unsigned char>& bytes){
+	FILE* file = fopen(path, "rb");
+	if(file == NULL){
+		printf("%s: cannot open file\n", path);
+		return false;
+	}
+	unsigned char chunk[65536];
+	size_t read;
+	bytes.clear();
+	while((read = fread(chunk, 1, sizeof(chunk), file)) > 0){
+		bytes.insert(bytes.end(), chunk, chunk + read);
+	}
+	fclose(file);
+	return true;
+}
 
-	char *verticesPtr = (char*)glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
-	char *indicesPtr = (char*)glMapBuffer(GL_ELEMENT_ARRAY_BUFFER, GL_WRITE_ONLY);
+// Decode time of each --texture across thread counts, checked against the single threaded pixels
+void benchmarkDecode(){
+	if(texturePaths.empty()){
+		printf("Decode benchmark needs at least one --texture\n");
+		return;
+	}
+	int maxThreads = (int)std::thread::hardware_concurrency();
+	if(maxThreads < 1){
+		maxThreads = 1;
+	}
+	// The reference and single threaded decodes need stb_image without a parallel_for
+	GridWorkers probe(1);
+	if(!stbi_set_parallel_for(stbiParallelFor, &probe)){
+		printf("Decode benchmark needs stb_image's parallel_for, another one is installed\n");
+		return;
+	}
+	stbi_set_parallel_for(NULL, &probe);
+	const int passes = 5;
+	for(size_t i = 0; i < texturePaths.size(); i++){
+		std::vector<unsigned char> bytes;
+		if(!readFileBytes(texturePaths[i], bytes)){
+			continue;
+		}
 
-	for(int y = 0; y < gridSize; y++){
-		for(int x = 0; x < gridSize; x++){
-			unsigned int square = (gridSize*y+x);
-			float colorRed = (float)rand()/RAND_MAX;
-			float colorGreen = (float)rand()/RAND_MAX;
-			float colorBlue = (float)rand()/RAND_MAX;
-			float vertices[] = {
-				0.5f+x, 0.5f+y, 0.0f,		colorRed, colorGreen, colorBlue,	1.0f, 1.0f,
-				0.5f+x, -0.5f+y, 0.0f,		colorRed, colorGreen, colorBlue,	1.0f, 0.0f,
+		int width, height, channels;
+		unsigned char* reference = stbi_load_from_memory(bytes.data(), (int)bytes.size(), &width, &height, &channels, 4);
+		if(reference == NULL){
+			printf("%s: %s\n", texturePaths[i], stbi_failure_reason());
+			continue;
+		}
+		printf("Decode benchmark, %s, %dx%d\n", texturePaths[i], width, height);
+		size_t pixels = (size_t)width*height;
+		for(int threads = 1; ; threads *= 2){
+			if(threads > maxThreads){
+				threads = maxThreads;
+			}
+			GridWorkers workers(threads);
+			if(threads > 1){
+				stbi_set_parallel_for(stbiParallelFor, &workers);
+			}
+			bool identical = true;
+			auto start = std::chrono::steady_clock::now();
+			for(int pass = 0; pass < passes; pass++){
+				unsigned char* decoded = stbi_load_from_memory(bytes.data(), (int)bytes.size(), &width, &height, &channels, 4);
+				identical = identical && decoded && memcmp(decoded, reference, pixels*4) == 0;
+				stbi_image_free(decoded);
+			}
+			double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()/passes;
+			stbi_set_parallel_for(NULL, &workers);
+			printf("%2d threads: %8.2f ms %7.1f Mpixels/s%s\n", threads, time*1000.0, pixels/time/1e6, identical ? "" : " (pixels differ)");
+
+			if(threads == maxThreads){
+				break;
+			}
+		}
+		stbi_image_free(reference);
+	}
+}
+
+// Throughput of the stb_image JPEG kernels (file statics of the implementation compiled into this file),
+// scalar against SSE2 and AVX2 where the CPU has them, each checked against the scalar output
+void benchmarkJpegKernels(){
+	struct JpegKernels{
+		const char* name;
+		void (*idct)(stbi_uc* out, int outStride, short* data);
+		void (*idctPair)(stbi_uc* out, int outStride, short* data);
+		stbi_uc* (*upsample)(stbi_uc* out, stbi_uc* inNear, stbi_uc* inFar, int w, int hs);
+		void (*color)(stbi_uc* out, const stbi_uc* y, const stbi_uc* cb, const stbi_uc* cr, int count, int step);
+	};
+	std::vector<JpegKernels> kernels;
+	kernels.push_back({"scalar", stbi__idct_block, NULL, stbi__resample_row_hv_2, stbi__YCbCr_to_RGB_row});
+#ifdef STBI_SSE2
+	if(stbi__sse2_available()){
+		kernels.push_back({"sse2", stbi__idct_simd, NULL, stbi__resample_row_hv_2_simd, stbi__YCbCr_to_RGB_simd});
+	}
+#endif
+#ifdef STBI_AVX2
+	if(stbi__avx2_available()){
+		kernels.push_back({"avx2", NULL, stbi__idct_avx2, stbi__resample_row_hv_2_avx2, stbi__YCbCr_to_RGB_avx2});
+	}
+#endif
+
+	// One plane's worth of work at each stage: luma blocks, a 4:2:0 chroma plane upsampled, every row to RGBA
+	const int width = 4096;
+	const int height = 512;
+	const int blocksWide = width/8;
+	const int blocks = blocksWide*(height/8);
+	std::vector<short> coefficients((size_t)blocks*64);
+	std::vector<stbi_uc> chroma((size_t)width/2*height/2);
+	unsigned int seed = 1;
+	auto nextRandom = [&](){
+		seed = seed*1664525u + 1013904223u;
+		return (int)(seed >> 16);
+	};
+	// Dequantized blocks are mostly zero past the first few coefficients
+	for(int i = 0; i < blocks; i++){
+		for(int k = 0; k < 64; k++){
+			coefficients[(size_t)i*64 + k] = k == 0 ? (short)(nextRandom()%2048 - 1024) : k < 10 || nextRandom()%8 == 0 ? (short)(nextRandom()%256 - 128) : 0;
+		}
+	}
+	for(size_t i = 0; i < chroma.size(); i++){
+		chroma[i] = (stbi_uc)nextRandom();
+	}
+
+	std::vector<stbi_uc> idctReference, upsampleReference, colorReference;
+	std::vector<stbi_uc> idctOut((size_t)width*height), upsampleOut((size_t)width*height), colorOut((size_t)width*height*4);
+	const int passes = 20;
+	auto seconds = [&](std::function<void()> pass){
+		auto start = std::chrono::steady_clock::now();
+		for(int i = 0; i < passes; i++){
+			pass();
+		}
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()/passes;
+	};
+	double pixels = (double)width*height;
+
+	printf("JPEG kernel benchmark, %dx%d pixels per pass (the decoder uses the last kernels listed)\n", width, height);
+	for(size_t k = 0; k < kernels.size(); k++){
+		const JpegKernels& kernel = kernels[k];
+		double idctTime = seconds([&](){
+			for(int i = 0; i < blocks; i++){
+				stbi_uc* out = idctOut.data() + (size_t)(i/blocksWide)*8*width + (i%blocksWide)*8;
+				if(kernel.idctPair){
+					kernel.idctPair(out, width, coefficients.data() + (size_t)i*64);
+					i++;
+				}
+				else{
+					kernel.idct(out, width, coefficients.data() + (size_t)i*64);
+				}
+			}
+		});
+		double upsampleTime = seconds([&](){
+			int chromaWidth = width/2;
+			for(int y = 0; y < height; y++){
+				int nearRow = y/2;
+				int farRow = y & 1 ? nearRow + 1 : nearRow - 1;
+				if(farRow < 0 || farRow >= height/2){
+					farRow = nearRow;
+				}
+				kernel.upsample(upsampleOut.data() + (size_t)y*width, chroma.data() + (size_t)nearRow*chromaWidth, chroma.data() + (size_t)farRow*chromaWidth, chromaWidth, 2);
+			}
+		});
+		double colorTime = seconds([&](){
+			for(int y = 0; y < height; y++){
+				const stbi_uc* cb = upsampleOut.data() + (size_t)y*width;
+				const stbi_uc* cr = upsampleOut.data() + (size_t)(height - 1 - y)*width;
+				kernel.color(colorOut.data() + (size_t)y*width*4, idctOut.data() + (size_t)y*width, cb, cr, width, 4);
+			}
+		});
+
+		bool identical = true;
+		if(k == 0){
+			idctReference = idctOut;
+			upsampleReference = upsampleOut;
+			colorReference = colorOut;
+		}
+		else{
+			identical = idctOut == idctReference && upsampleOut == upsampleReference && colorOut == colorReference;
+		}
+		printf("%-6s: idct %7.2f ms %7.1f Mpixels/s | upsample %7.2f ms %7.1f Mpixels/s | color %7.2f ms %7.1f Mpixels/s%s\n",
+			kernel.name, idctTime*1000.0, pixels/idctTime/1e6, upsampleTime*1000.0, pixels/upsampleTime/1e6,
+			colorTime*1000.0, pixels/colorTime/1e6, identical ? "" : " (output differs)");
+	}
+}
+
+// RGBA decode throughput of the --texture PNGs with stb_image's zlib fast loop and SSE2 defilters (file statics of
+// the implementation compiled into this file) turned off and on, checked against the pixels of the careful path
+void benchmarkPng(){
+	struct PngPath{
+		const char* name;
+		int fastLoop;
+		int simd;
+	};
+	std::vector<PngPath> paths;
+	paths.push_back({"careful inflate, scalar filters", 0, 0});
+	paths.push_back({"fast inflate, scalar filters", 1, 0});
+#ifdef STBI_SSE2
+	if(stbi__sse2_available()){
+		paths.push_back({"fast inflate, sse2 filters", 1, 1});
+	}
+#endif
+	auto usePath = [](const PngPath& path){
+		stbi__zlib_fast_loop = path.fastLoop;
+#ifdef STBI_SSE2
+		stbi__png_simd = path.simd;
+#endif
+	};
+
+	const int passes = 5;
+	std::vector<double> totalTimes(paths.size(), 0.0);
+	double totalBytes = 0.0;
+	int files = 0;
+	for(size_t i = 0; i < texturePaths.size(); i++){
+		std::vector<unsigned char> bytes;
+		if(!readFileBytes(texturePaths[i], bytes)){
+			continue;
+		}
+		if(bytes.size() < 8 || memcmp(bytes.data(), "\x89PNG\r\n\x1a\n", 8) != 0){
+			printf("%s: not a PNG\n", texturePaths[i]);
+			continue;
+		}
 
-				-0.5f+x, -0.5f+y, 0.0f,		colorRed, colorGreen, colorBlue,	0.0f, 0.0f,
-				-0.5f+x, 0.5f+y, 0.0f,		colorRed, colorGreen, colorBlue,	0.0f, 1.0f
-			};
+		int width, height, channels;
+		usePath(paths[0]);
+		unsigned char* reference = stbi_load_from_memory(bytes.data(), (int)bytes.size(), &width, &height, &channels, 4);
+		if(reference == NULL){
+			printf("%s: %s\n", texturePaths[i], stbi_failure_reason());
+			continue;
+		}
+		size_t outputBytes = (size_t)width*height*4;
+		printf("PNG benchmark, %s, %dx%d, %d channels, %.2f MB compressed\n", texturePaths[i], width, height, channels, bytes.size()/1e6);
+		for(size_t p = 0; p < paths.size(); p++){
+			usePath(paths[p]);
+			bool identical = true;
+			auto start = std::chrono::steady_clock::now();
+			for(int pass = 0; pass < passes; pass++){
+				unsigned char* decoded = stbi_load_from_memory(bytes.data(), (int)bytes.size(), &width, &height, &channels, 4);
+				identical = identical && decoded && memcmp(decoded, reference, outputBytes) == 0;
+				stbi_image_free(decoded);
+			}
+			double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()/passes;
+			totalTimes[p] += time;
+			printf("%-32s %8.2f ms %8.1f MB/s%s\n", paths[p].name, time*1000.0, outputBytes/time/1e6, identical ? "" : " (pixels differ)");
+		}
+		stbi_image_free(reference);
+		totalBytes += outputBytes;
+		files++;
+	}
+	if(files == 0){
+		printf("PNG benchmark needs at least one PNG --texture\n");
+	}
+	else if(files > 1){
+		printf("Corpus of %d PNGs, %.1f MB of RGBA\n", files, totalBytes/1e6);
+		for(size_t p = 0; p < paths.size(); p++){
+			printf("%-32s %8.2f ms %8.1f MB/s\n", paths[p].name, totalTimes[p]*1000.0, totalBytes/totalTimes[p]/1e6);
+		}
+	}
+	usePath(paths.back());
+}
 
-			unsigned int indices[] = {
-				0+square*4, 1+square*4, 3+square*4,
-				1+square*4, 2+square*4, 3+square*4
-			};
+// Time to build every grid program without (cold) and with (warm) binaries in the program cache
+void benchmarkStartup(ProgramCache* cache, const char* directory, const char** vertexShaders, const char** defines, int count){
+	if(cache == NULL || !cache->enabled()){
+		printf("Startup benchmark needs a working program cache\n");
+		return;
+	}
+	// Same sources as ShaderVariants builds, the defines apply to both stages
+	std::vector<ShaderSource> vertexSources(count), fragmentSources(count);
+	for(int i = 0; i < count; i++){
+		if(!vertexSources[i].load((std::string(directory) + "/" + vertexShaders[i]).c_str(), defines[i])
+			|| !fragmentSources[i].load((std::string(directory) + "/grid.fs").c_str(), defines[i])){
+			return;
+		}
+	}
+	const int passes = 5;
+	double best[2] = {1e30, 1e30};
+	double total[2] = {0.0, 0.0};
+	for(int pass = 0; pass < passes; pass++){
+		for(int warm = 0; warm < 2; warm++){
+			if(!warm){
+				for(int i = 0; i < count; i++){
+					cache->evict(vertexSources[i].code.c_str(), fragmentSources[i].code.c_str());
+				}
+			}
+			auto start = std::chrono::steady_clock::now();
+			for(int i = 0; i < count; i++){
+				Shader* shader = Shader::fromSource(vertexSources[i].code.c_str(), fragmentSources[i].code.c_str(), cache);
+				shader->use();
+				delete shader;
+			}
+			glFinish();
+			double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			best[warm] = ms < best[warm] ? ms : best[warm];
+			total[warm] += ms;
+		}
+	}
+	printf("Startup benchmark, %d programs, %d passes (ms)    min      avg\n", count, passes);
+	printf("  cold (compile, link, store)             %8.2f %8.2f\n", best[0], total[0]/passes);
+	printf("  warm (load binary)                      %8.2f %8.2f\n", best[1], total[1]/passes);
+	printf("Cache hits %d, misses %d\n", cache->hits, cache->misses);
+}
 
-			memcpy(verticesPtr, vertices, sizeof(vertices));
-			verticesPtr += sizeof(vertices);
+// Draws per second of each submission path, with the grid split into draws of a few cells.
+// Rasterization is off, so the time is submission and vertex work.
+void benchmarkDraws(Shader* gridShader, int gridSize){
+	if(gridMode != GRID_MODE_EXPANDED && gridMode != GRID_MODE_INSTANCED){
+		printf("Draw benchmark needs --mode expanded or instanced\n");
+		return;
+	}
+	if(gridMode == GRID_MODE_INSTANCED && !GLAD_GL_ARB_base_instance){
+		printf("Instanced draw benchmark needs ARB_base_instance\n");
+		return;
+	}
+	gridData->generate(gridWorkers, gridSeed);
+	if(gridMode == GRID_MODE_EXPANDED){
+		expandGrid(gridSize);
+		writeRect(gridSize);
+	}
+	else{
+		writeInstances(gridSize);
+	}
+	while(!continueUpload()){
+	}
 
-			memcpy(indicesPtr, indices, sizeof(indices));
-			indicesPtr += sizeof(indices);
+	// Blocks the frames would bind, the grid is drawn untransformed
+	FrameUniforms frame = {glm::mat4(1.0f), 0.0f, {0.0f, 0.0f, 0.0f}};
+	ObjectUniforms object = {glm::mat4(1.0f)};
+	unsigned int blocks[2];
+	glGenBuffers(2, blocks);
+	glState().bindBuffer(GL_UNIFORM_BUFFER, blocks[0]);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(frame), &frame, GL_STATIC_DRAW);
+	glState().bindBuffer(GL_UNIFORM_BUFFER, blocks[1]);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(object), &object, GL_STATIC_DRAW);
+	glState().bindBufferRange(GL_UNIFORM_BUFFER, RENDER_FRAME_BINDING, blocks[0], 0, sizeof(frame));
+	glState().bindBufferRange(GL_UNIFORM_BUFFER, RENDER_OBJECT_BINDING, blocks[1], 0, sizeof(object));
+	gridShader->use();
+	glState().bindVertexArray(gridMode == GRID_MODE_EXPANDED ? VAO[vertexStream->region()] : instanceVAO[instanceStream->region()]);
+	GLenum indexType = gridMode == GRID_MODE_EXPANDED && shortIndices ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+	glEnable(GL_RASTERIZER_DISCARD);
+
+	const unsigned int cellsPerDraw = 16;
+	size_t cells = (size_t)gridSize*gridSize;
+	printf("Draw benchmark, %dx%d grid, %s, %u cells per draw\n", gridSize, gridSize, gridMode == GRID_MODE_EXPANDED ? "expanded" : "instanced", cellsPerDraw);
+	printf("   draws   path       submit ms   total ms    Mdraws/s\n");
+	std::vector<GridSpan> spans;
+	for(size_t draws = 256; ; draws *= 16){
+		if(draws > cells/cellsPerDraw){
+			draws = cells/cellsPerDraw;
+		}
+		// Spread over the whole grid, so chunked indices split nothing but still change base vertex
+		spans.clear();
+		for(size_t i = 0; i < draws; i++){
+			GridSpan span;
+			span.first = (unsigned int)(i*cells/draws);
+			span.last = span.first + cellsPerDraw;
+			spans.push_back(span);
+		}
+		drawCommands->clear();
+		addSpanCommands(spans.data(), spans.size());
+
+		for(int path = 0; path < DRAW_SUBMIT_COUNT; path++){
+			if(drawCommands->resolve((DrawSubmit)path) != path){
+				printf("%8zu   %-8s          unsupported\n", draws, drawSubmitNames[path]);
+				continue;
+			}
+			// One warm-up pass, then as many as fit in a quarter second
+			drawCommands->submit(GL_TRIANGLES, indexType, (DrawSubmit)path);
+			glFinish();
+			int passes = 0;
+			double submitTime = 0.0;
+			auto start = std::chrono::steady_clock::now();
+			double elapsed = 0.0;
+			while(elapsed < 0.25 || passes < 3){
+				auto submitStart = std::chrono::steady_clock::now();
+				drawCommands->submit(GL_TRIANGLES, indexType, (DrawSubmit)path);
+				submitTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - submitStart).count();
+				glFinish();
+				passes++;
+				elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			}
+			printf("%8zu   %-8s %10.3f %10.3f %11.2f\n", draws, drawSubmitNames[path], submitTime*1000.0/passes, elapsed*1000.0/passes, draws*passes/elapsed/1e6);
+		}
+		if(draws == cells/cellsPerDraw){
+			break;
 		}
 	}
 
-	glUnmapBuffer(GL_ARRAY_BUFFER);
-	glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
-	glBindVertexArray(0);
+	glDisable(GL_RASTERIZER_DISCARD);
+	glDeleteBuffers(2, blocks);
+	glState().forgetBuffer(blocks[0]);
+	glState().forgetBuffer(blocks[1]);
+}
+
+// Full remap on the GPU against the CPU path: the time of each and whether they write the same bytes
+void benchmarkGpuGrid(int gridSize){
+	if(gridGenerator == NULL){
+		printf("GPU grid benchmark needs --mode expanded, instanced or procedural and a working gridgen.vs\n");
+		return;
+	}
+	size_t cells = (size_t)gridSize*gridSize;
+	size_t bytes = gridGenerator->size();
+	std::vector<unsigned char> cpu(bytes), gpu(bytes);
+	const int passes = 5;
+
+	// Reference: generate the CPU copy and write it out as uploads do
+	double cpuTime = 1e30;
+	for(int pass = 0; pass < passes; pass++){
+		auto start = std::chrono::steady_clock::now();
+		gridData->generate(gridWorkers, gridSeed + pass);
+		const GridInstance* source = gridData->cells.data();
+		unsigned char* out = cpu.data();
+		gridWorkers->run(gridSize, [=](int firstRow, int lastRow){
+			size_t first = (size_t)gridSize*firstRow;
+			size_t last = (size_t)gridSize*lastRow;
+			if(gridMode == GRID_MODE_EXPANDED){
+				expandVertices(vertexFormat, out, source, first, last);
+			}
+			else{
+				memcpy(out + first*sizeof(GridInstance), source + first, (last - first)*sizeof(GridInstance));
+			}
+		});
+		double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		cpuTime = time < cpuTime ? time : cpuTime;
+	}
+
+	unsigned int buffer, query;
+	glGenBuffers(1, &buffer);
+	glGenQueries(1, &query);
+	glState().bindBuffer(GL_ARRAY_BUFFER, buffer);
+	glBufferData(GL_ARRAY_BUFFER, bytes, NULL, GL_STATIC_READ);
+	double gpuTime = 1e30, wallTime = 1e30;
+	for(int pass = 0; pass < passes; pass++){
+		glFinish();
+		auto start = std::chrono::steady_clock::now();
+		glBeginQuery(GL_TIME_ELAPSED, query);
+		gridGenerator->generate(buffer, 0, gridSeed + pass);
+		glEndQuery(GL_TIME_ELAPSED);
+		glFinish();
+		double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		GLuint64 elapsed = 0;
+		glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+		wallTime = time < wallTime ? time : wallTime;
+		gpuTime = elapsed*1e-9 < gpuTime ? elapsed*1e-9 : gpuTime;
+	}
+	glState().bindBuffer(GL_ARRAY_BUFFER, buffer);
+	glGetBufferSubData(GL_ARRAY_BUFFER, 0, bytes, gpu.data());
+	glDeleteQueries(1, &query);
+	glDeleteBuffers(1, &buffer);
+	glState().forgetBuffer(buffer);
+
+	printf("GPU grid benchmark, %dx%d grid, %s (%d bytes per cell), best of %d\n", gridSize, gridSize,
+		gridMode == GRID_MODE_EXPANDED ? vertexFormats[vertexFormat].name : "instances", (int)gridGenerator->cellSize, passes);
+	printf("  CPU generate and write    %8.3f ms %8.1f Mcells/s\n", cpuTime*1000.0, cells/cpuTime/1e6);
+	printf("  GPU generate              %8.3f ms %8.1f Mcells/s (%.3f ms GPU time)\n", wallTime*1000.0, cells/wallTime/1e6, gpuTime*1000.0);
+
+	// Both last wrote the grid of the same seed
+	size_t differing = 0, first = 0;
+	for(size_t cell = 0; cell < cells; cell++){
+		if(memcmp(cpu.data() + cell*gridGenerator->cellSize, gpu.data() + cell*gridGenerator->cellSize, gridGenerator->cellSize) != 0){
+			first = differing++ ? first : cell;
+		}
+	}
+	if(differing){
+		printf("  %zu of %zu cells differ from the CPU path, the first is cell %zu\n", differing, cells, first);
+	}
+	else{
+		printf("  Matches the CPU path byte for byte\n");
+	}
 }
\ No newline at end of file
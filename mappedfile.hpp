@@ -0,0 +1,81 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <stdio.h>
+
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Bytes of a file, memory mapped where mmap exists and read in one sized allocation otherwise.
+// data is NULL when the file could not be opened.
+class MappedFile{
+	public:
+		const char* data;
+		size_t size;
+
+		MappedFile(const char* path){
+			data = NULL;
+			size = 0;
+			mapping = NULL;
+#ifdef _WIN32
+			FILE* file = fopen(path, "rb");
+			if(file == NULL){
+				return;
+			}
+			fseek(file, 0, SEEK_END);
+			long length = ftell(file);
+			fseek(file, 0, SEEK_SET);
+			if(length >= 0){
+				buffer.resize((size_t)length);
+				size = fread(buffer.data(), 1, buffer.size(), file);
+				data = buffer.data();
+			}
+			fclose(file);
+#else
+			int file = open(path, O_RDONLY);
+			if(file < 0){
+				return;
+			}
+			struct stat info;
+			if(fstat(file, &info) == 0){
+				size = (size_t)info.st_size;
+				if(size == 0){
+					data = "";
+				}
+				else{
+					mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, file, 0);
+					if(mapping == MAP_FAILED){
+						mapping = NULL;
+						size = 0;
+					}
+					else{
+						data = (const char*)mapping;
+					}
+				}
+			}
+			close(file);
+#endif
+		}
+
+		~MappedFile(){
+#ifndef _WIN32
+			if(mapping){
+				munmap(mapping, size);
+			}
+#endif
+		}
+
+	private:
+		void* mapping;
+		std::vector<char> buffer;
+
+		MappedFile(const MappedFile&);
+		MappedFile& operator=(const MappedFile&);
+};
+#endif
\ No newline at end of file
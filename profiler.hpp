@@ -0,0 +1,333 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "glad/glad.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+// CPU phases of a frame, in loop order. Input is timed on the main thread and
+// added with the packet, the rest on the render thread.
+enum ProfilerPhase{
+	PROFILER_INPUT,
+	PROFILER_RELOAD,
+	PROFILER_REMAP,
+	PROFILER_UNIFORMS,
+	PROFILER_DRAW,
+	PROFILER_SWAP,
+	PROFILER_PHASE_COUNT
+};
+
+const char* const profilerPhaseNames[PROFILER_PHASE_COUNT] = {"input", "reload", "remap", "uniforms", "draw", "swap"};
+
+// Milliseconds of one frame; gpu stays negative until its query result arrives
+struct ProfilerFrame{
+	double phases[PROFILER_PHASE_COUNT];
+	double frame;
+	double gpu;
+};
+
+// Per-frame timings in a ring of the last capacity frames. CPU phases are timed
+// with steady_clock, the GL work between beginGpu() and endGpu() with a
+// GL_TIME_ELAPSED query. Queries are read back QUERY_LATENCY frames late so the
+// CPU never waits on the GPU, and land in the frame that issued them.
+class Profiler{
+	public:
+		bool enabled;
+
+		Profiler(int capacity = 1024){
+			enabled = false;
+			this->capacity = capacity;
+			frames.resize(capacity);
+			count = 0;
+			next = 0;
+			queryCount = 0;
+			queryNext = 0;
+			phase = -1;
+			queries[0] = 0;
+		}
+
+		~Profiler(){
+			if(queries[0]){
+				glDeleteQueries(QUERY_LATENCY, queries);
+			}
+		}
+
+		// Needs a current GL context
+		void enable(){
+			enabled = true;
+			glGenQueries(QUERY_LATENCY, queries);
+		}
+
+		void beginFrame(){
+			if(!enabled){
+				return;
+			}
+			Clock::time_point now = Clock::now();
+			if(count > 0){
+				ProfilerFrame& last = frames[(next + capacity - 1) % capacity];
+				last.frame = milliseconds(frameStart, now);
+			}
+			frameStart = now;
+			ProfilerFrame& current = frames[next];
+			for(int i = 0; i < PROFILER_PHASE_COUNT; i++){
+				current.phases[i] = 0.0;
+			}
+			current.frame = -1.0;
+			current.gpu = -1.0;
+		}
+
+		// Phases may be entered several times a frame, their times add up
+		void begin(ProfilerPhase phase){
+			if(!enabled){
+				return;
+			}
+			this->phase = phase;
+			phaseStart = Clock::now();
+		}
+
+		void end(){
+			if(!enabled || phase < 0){
+				return;
+			}
+			frames[next].phases[phase] += milliseconds(phaseStart, Clock::now());
+			phase = -1;
+		}
+
+		// Adds milliseconds timed elsewhere, such as on another thread, to phase of this frame
+		void add(ProfilerPhase phase, double time){
+			if(!enabled){
+				return;
+			}
+			frames[next].phases[phase] += time;
+		}
+
+		void beginGpu(){
+			if(!enabled){
+				return;
+			}
+			// Reuses the oldest query, collect its result first
+			if(queryCount == QUERY_LATENCY){
+				collectOldest();
+			}
+			int slot = queryNext % QUERY_LATENCY;
+			queryFrames[slot] = next;
+			queryStarts[slot] = Clock::now();
+			glBeginQuery(GL_TIME_ELAPSED, queries[slot]);
+		}
+
+		void endGpu(){
+			if(!enabled){
+				return;
+			}
+			glEndQuery(GL_TIME_ELAPSED);
+			queryNext++;
+			queryCount++;
+		}
+
+		void endFrame(){
+			if(!enabled){
+				return;
+			}
+			next = (next + 1) % capacity;
+			count = std::min(count + 1, capacity);
+		}
+
+		// Prints min/avg/p99 of every column
+		void printSummary(){
+			if(!enabled || count == 0){
+				return;
+			}
+			finish();
+			printf("Profile of the last %d frames (ms)    min      avg      p99\n", count);
+			for(int column = 0; column < COLUMN_COUNT; column++){
+				double stats[3];
+				if(summarize(column, stats)){
+					printf("  %-34s %8.3f %8.3f %8.3f\n", columnName(column), stats[0], stats[1], stats[2]);
+				}
+			}
+		}
+
+		// Writes every recorded frame as CSV when path ends in .csv, otherwise as JSON with the min/avg/p99 summary
+		bool dump(const char* path){
+			if(!enabled){
+				return false;
+			}
+			finish();
+			FILE* file = fopen(path, "w");
+			if(file == NULL){
+				printf("Failed to open profile output %s\n", path);
+				return false;
+			}
+			size_t length = strlen(path);
+			if(length >= 4 && strcmp(path + length - 4, ".csv") == 0){
+				writeCsv(file);
+			}
+			else{
+				writeJson(file);
+			}
+			fclose(file);
+			printf("Profile of %d frames written to %s\n", count, path);
+			return true;
+		}
+
+	private:
+		typedef std::chrono::steady_clock Clock;
+		static const int QUERY_LATENCY = 4;
+		// Columns are the phases, then cpu (sum of phases), frame and gpu
+		static const int COLUMN_COUNT = PROFILER_PHASE_COUNT + 3;
+
+		std::vector<ProfilerFrame> frames;
+		int capacity;
+		int count;
+		int next;
+		int phase;
+		Clock::time_point frameStart;
+		Clock::time_point phaseStart;
+		unsigned int queries[QUERY_LATENCY];
+		// Frame each query slot was issued in and when
+		int queryFrames[QUERY_LATENCY];
+		Clock::time_point queryStarts[QUERY_LATENCY];
+		// Queries issued and not read back yet, and the slot count issued so far
+		int queryCount;
+		int queryNext;
+
+		static double milliseconds(Clock::time_point start, Clock::time_point end){
+			return std::chrono::duration<double, std::milli>(end - start).count();
+		}
+
+		// Reads the oldest query in flight into its frame, waiting if needed
+		void collectOldest(){
+			int slot = (queryNext - queryCount) % QUERY_LATENCY;
+			GLuint64 elapsed = 0;
+			glGetQueryObjectui64v(queries[slot], GL_QUERY_RESULT, &elapsed);
+			// The GPU cannot take longer than the wall time since the query began. llvmpipe loses
+			// the start of a query when its scene is flushed halfway and reports time since boot.
+			double gpu = elapsed/1000000.0;
+			if(gpu <= milliseconds(queryStarts[slot], Clock::now())){
+				frames[queryFrames[slot]].gpu = gpu;
+			}
+			queryCount--;
+		}
+
+		// Collects the queries still in flight and closes the last frame
+		void finish(){
+			while(queryCount > 0){
+				collectOldest();
+			}
+			if(count > 0){
+				ProfilerFrame& last = frames[(next + capacity - 1) % capacity];
+				if(last.frame < 0.0){
+					last.frame = milliseconds(frameStart, Clock::now());
+				}
+			}
+		}
+
+		const char* columnName(int column){
+			if(column < PROFILER_PHASE_COUNT){
+				return profilerPhaseNames[column];
+			}
+			const char* names[] = {"cpu", "frame", "gpu"};
+			return names[column - PROFILER_PHASE_COUNT];
+		}
+
+		// Negative when the frame has no value for column
+		double value(const ProfilerFrame& frame, int column){
+			if(column < PROFILER_PHASE_COUNT){
+				return frame.phases[column];
+			}
+			if(column == PROFILER_PHASE_COUNT){
+				double cpu = 0.0;
+				for(int i = 0; i < PROFILER_PHASE_COUNT; i++){
+					cpu += frame.phases[i];
+				}
+				return cpu;
+			}
+			return column == PROFILER_PHASE_COUNT + 1 ? frame.frame : frame.gpu;
+		}
+
+		// Oldest recorded frame first
+		const ProfilerFrame& recorded(int i){
+			return frames[(next + capacity - count + i) % capacity];
+		}
+
+		// min, avg and p99 of column over the recorded frames
+		bool summarize(int column, double stats[3]){
+			std::vector<double> values;
+			for(int i = 0; i < count; i++){
+				double v = value(recorded(i), column);
+				if(v >= 0.0){
+					values.push_back(v);
+				}
+			}
+			if(values.empty()){
+				return false;
+			}
+			double sum = 0.0;
+			for(size_t i = 0; i < values.size(); i++){
+				sum += values[i];
+			}
+			size_t p99 = (values.size()*99)/100;
+			if(p99 >= values.size()){
+				p99 = values.size() - 1;
+			}
+			std::nth_element(values.begin(), values.begin() + p99, values.end());
+			stats[0] = *std::min_element(values.begin(), values.end());
+			stats[1] = sum/values.size();
+			stats[2] = values[p99];
+			return true;
+		}
+
+		void writeCsv(FILE* file){
+			fprintf(file, "frame");
+			for(int column = 0; column < COLUMN_COUNT; column++){
+				fprintf(file, ",%s", columnName(column));
+			}
+			fprintf(file, "\n");
+			for(int i = 0; i < count; i++){
+				fprintf(file, "%d", i);
+				for(int column = 0; column < COLUMN_COUNT; column++){
+					double v = value(recorded(i), column);
+					if(v >= 0.0){
+						fprintf(file, ",%.4f", v);
+					}
+					else{
+						fprintf(file, ",");
+					}
+				}
+				fprintf(file, "\n");
+			}
+		}
+
+		void writeJson(FILE* file){
+			fprintf(file, "{\n\t\"frames\": %d,\n\t\"summary\": {", count);
+			bool first = true;
+			for(int column = 0; column < COLUMN_COUNT; column++){
+				double stats[3];
+				if(summarize(column, stats)){
+					fprintf(file, "%s\n\t\t\"%s\": {\"min\": %.4f, \"avg\": %.4f, \"p99\": %.4f}", first ? "" : ",", columnName(column), stats[0], stats[1], stats[2]);
+					first = false;
+				}
+			}
+			fprintf(file, "\n\t},\n\t\"samples\": [");
+			for(int i = 0; i < count; i++){
+				fprintf(file, "%s\n\t\t{", i ? "," : "");
+				for(int column = 0; column < COLUMN_COUNT; column++){
+					double v = value(recorded(i), column);
+					if(v >= 0.0){
+						fprintf(file, "%s\"%s\": %.4f", column ? ", " : "", columnName(column), v);
+					}
+					else{
+						fprintf(file, "%s\"%s\": null", column ? ", " : "", columnName(column));
+					}
+				}
+				fprintf(file, "}");
+			}
+			fprintf(file, "\n\t]\n}\n");
+		}
+};
+#endif
\ No newline at end of file
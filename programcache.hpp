@@ -0,0 +1,183 @@
+#ifndef PROGRAMCACHE_H
+#define PROGRAMCACHE_H
+
+#include "glad/glad.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+// FNV-1a, continued from hash
+inline uint64_t programCacheHash(const void* data, size_t size, uint64_t hash = 14695981039346656037ull){
+	const unsigned char* bytes = (const unsigned char*)data;
+	for(size_t i = 0; i < size; i++){
+		hash = (hash ^ bytes[i])*1099511628211ull;
+	}
+	return hash;
+}
+
+// Linked program binaries on disk, one file per program. A program is keyed by
+// a hash of its sources and the GL vendor, renderer and version, so a driver
+// change misses instead of loading a stale binary; binaries the driver still
+// rejects are recompiled and overwritten.
+class ProgramCache{
+	public:
+		int hits;
+		int misses;
+
+		// Needs a current GL context, the directory is created when missing
+		ProgramCache(const char* directory){
+			this->directory = directory;
+			hits = 0;
+			misses = 0;
+			int formats = 0;
+			if(GLAD_GL_ARB_get_program_binary){
+				glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+			}
+			supported = formats > 0;
+			if(!supported){
+				printf("Program binaries not supported, shaders compile at every start\n");
+				return;
+			}
+#ifdef _WIN32
+			_mkdir(directory);
+#else
+			mkdir(directory, 0755);
+#endif
+			const char* strings[] = {(const char*)glGetString(GL_VENDOR), (const char*)glGetString(GL_RENDERER), (const char*)glGetString(GL_VERSION)};
+			driverHash = programCacheHash(NULL, 0);
+			for(int i = 0; i < 3; i++){
+				driverHash = programCacheHash(strings[i], strlen(strings[i]) + 1, driverHash);
+			}
+		}
+
+		bool enabled(){
+			return supported;
+		}
+
+		// Call before linking a program that will be stored
+		void prepare(unsigned int program){
+			if(supported){
+				glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+			}
+		}
+
+		// Linked program for the sources, or 0 when there is no usable binary
+		unsigned int load(const char* vertexSource, const char* fragmentSource){
+			if(!supported){
+				return 0;
+			}
+			uint64_t key = hash(vertexSource, fragmentSource);
+			FILE* file = fopen(path(key).c_str(), "rb");
+			if(file == NULL){
+				misses++;
+				return 0;
+			}
+			Header header;
+			std::vector<char> binary;
+			bool valid = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, "GLPB", 4) == 0 && header.key == key;
+			if(valid){
+				binary.resize(header.length);
+				valid = fread(binary.data(), 1, binary.size(), file) == binary.size();
+			}
+			fclose(file);
+
+			unsigned int program = 0;
+			if(valid){
+				program = glCreateProgram();
+				glProgramBinary(program, header.format, binary.data(), (GLsizei)binary.size());
+				int success = 0;
+				glGetProgramiv(program, GL_LINK_STATUS, &success);
+				if(!success){
+					glDeleteProgram(program);
+					program = 0;
+				}
+			}
+			if(program){
+				hits++;
+			}
+			else{
+				misses++;
+			}
+			return program;
+		}
+
+		// Writes the binary of a linked program, through a temporary file so readers never see half of it
+		void store(unsigned int program, const char* vertexSource, const char* fragmentSource){
+			if(!supported){
+				return;
+			}
+			int length = 0;
+			glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+			if(length <= 0){
+				return;
+			}
+			Header header;
+			memset(&header, 0, sizeof(header));
+			memcpy(header.magic, "GLPB", 4);
+			header.key = hash(vertexSource, fragmentSource);
+			std::vector<char> binary(length);
+			GLsizei written = 0;
+			glGetProgramBinary(program, length, &written, &header.format, binary.data());
+			header.length = (uint32_t)written;
+
+			std::string target = path(header.key);
+			std::string temporary = target + ".tmp";
+			FILE* file = fopen(temporary.c_str(), "wb");
+			if(file == NULL){
+				printf("Failed to write program cache %s\n", temporary.c_str());
+				return;
+			}
+			bool ok = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(binary.data(), 1, written, file) == (size_t)written;
+			ok = fclose(file) == 0 && ok;
+#ifdef _WIN32
+			// rename does not replace existing files here
+			remove(target.c_str());
+#endif
+			if(!ok || rename(temporary.c_str(), target.c_str()) != 0){
+				printf("Failed to write program cache %s\n", target.c_str());
+				remove(temporary.c_str());
+			}
+		}
+
+		// Deletes the binary for the sources, for cold start measurements
+		void evict(const char* vertexSource, const char* fragmentSource){
+			if(supported){
+				remove(path(hash(vertexSource, fragmentSource)).c_str());
+			}
+		}
+
+	private:
+		struct Header{
+			char magic[4];
+			uint32_t format;
+			uint64_t key;
+			uint32_t length;
+			uint32_t padding;
+		};
+
+		std::string directory;
+		bool supported;
+		uint64_t driverHash;
+
+		uint64_t hash(const char* vertexSource, const char* fragmentSource){
+			uint64_t key = programCacheHash(vertexSource, strlen(vertexSource) + 1, driverHash);
+			return programCacheHash(fragmentSource, strlen(fragmentSource) + 1, key);
+		}
+
+		std::string path(uint64_t key){
+			char name[32];
+			snprintf(name, sizeof(name), "/%016llx.bin", (unsigned long long)key);
+			return directory + name;
+		}
+};
+#endif
\ No newline at end of file
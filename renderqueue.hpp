@@ -0,0 +1,268 @@
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include "glad/glad.h"
+#include "glstate.hpp"
+#include "streambuffer.hpp"
+#include "glm/glm.hpp"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+// Linear allocator for one frame of render packets. Memory comes from blocks that
+// are kept across reset(), so after the first frames allocating is a pointer bump
+// and pointers stay valid until the next reset().
+class RenderArena{
+	public:
+		RenderArena(size_t blockSize = 64*1024){
+			this->blockSize = blockSize;
+			block = 0;
+			used = 0;
+		}
+
+		~RenderArena(){
+			for(size_t i = 0; i < blocks.size(); i++){
+				free(blocks[i].data);
+			}
+		}
+
+		// size bytes aligned to align, a power of two up to 16
+		void* allocate(size_t size, size_t align = 16){
+			while(true){
+				if(block < blocks.size()){
+					size_t start = (used + align - 1) & ~(align - 1);
+					if(start + size <= blocks[block].size){
+						used = start + size;
+						return blocks[block].data + start;
+					}
+					block++;
+					used = 0;
+					continue;
+				}
+				// Larger requests get a block of their own size
+				Block next = {(char*)malloc(size > blockSize ? size : blockSize), size > blockSize ? size : blockSize};
+				blocks.push_back(next);
+			}
+		}
+
+		// Frees everything allocated, keeping the blocks
+		void reset(){
+			block = 0;
+			used = 0;
+		}
+
+		// Bytes held in blocks, used or not
+		size_t capacity(){
+			size_t total = 0;
+			for(size_t i = 0; i < blocks.size(); i++){
+				total += blocks[i].size;
+			}
+			return total;
+		}
+
+	private:
+		struct Block{
+			char* data;
+			size_t size;
+		};
+
+		std::vector<Block> blocks;
+		size_t blockSize;
+		size_t block;
+		size_t used;
+
+		RenderArena(const RenderArena&);
+		RenderArena& operator=(const RenderArena&);
+};
+
+// Uniform buffer binding points of FrameBlock and ObjectBlock, see shaders/grid.glsl
+#define RENDER_FRAME_BINDING 0
+#define RENDER_OBJECT_BINDING 1
+
+// std140 layout of FrameBlock
+struct FrameUniforms{
+	glm::mat4 viewProjection;
+	float time;
+	float padding[3];
+};
+
+// std140 layout of ObjectBlock
+struct ObjectUniforms{
+	glm::mat4 model;
+};
+
+// Issues the draw calls of a packet, with its program, vertex array, texture and object block bound
+typedef void (*RenderDraw)(const void* payload);
+
+// State a draw needs. texture is bound to unit 0 unless textureTarget is 0.
+struct RenderPacket{
+	unsigned int program;
+	unsigned int vertexArray;
+	GLenum textureTarget;
+	unsigned int texture;
+	ObjectUniforms object;
+	RenderDraw draw;
+	void* payload;
+};
+
+// Draw packets collected over a frame and executed in one go, sorted so packets
+// sharing state run back to back. The 64-bit key holds, from the top:
+//
+//   program 12 bits | vertex array 12 bits | texture 16 bits | depth 24 bits
+//
+// GL names are small sequential integers, so the low bits tell objects apart;
+// names that collide only sort less well, every packet still binds its full state
+// through glState(). Packets with equal keys keep their submission order.
+//
+// Uniforms go through one ring of uniform buffer regions, a region per frame: the
+// frame block first, then the object block of every packet, each at an offset
+// aligned for glBindBufferRange. A frame writes its region once, straight into
+// the mapping, and every draw only binds its range.
+class RenderQueue{
+	public:
+		RenderArena arena;
+		// Packets run by the last execute(), and packets dropped since construction for lack of object blocks
+		int executed;
+		int dropped;
+
+		// Needs a current GL context. maxObjects is the number of packets a frame can hold.
+		RenderQueue(int maxObjects = 4096){
+			executed = 0;
+			dropped = 0;
+			this->maxObjects = maxObjects;
+			objectCount = 0;
+			mapped = NULL;
+			regionOffset = 0;
+			int alignment = 0;
+			glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+			this->alignment = alignment > 0 ? (size_t)alignment : 256;
+			frameSize = alignUp(sizeof(FrameUniforms));
+			objectSize = alignUp(sizeof(ObjectUniforms));
+			uniforms = new StreamBuffer(GL_UNIFORM_BUFFER, frameSize + objectSize*maxObjects);
+		}
+
+		~RenderQueue(){
+			delete uniforms;
+		}
+
+		// Starts a frame's packets, every beginFrame() must be followed by an execute()
+		void beginFrame(const FrameUniforms& frame){
+			regionOffset = uniforms->size()*uniforms->nextRegion();
+			mapped = (char*)uniforms->beginWrite();
+			memcpy(mapped, &frame, sizeof(frame));
+			objectCount = 0;
+		}
+
+		// Queues a copy of packet and returns payloadSize bytes for its draw callback to read, valid
+		// until execute() returns. depth in [0, 1] orders packets sharing all state, nearest first.
+		// Past maxObjects packets in a frame the packet is dropped, the payload is still returned.
+		void* submit(const RenderPacket& packet, float depth, size_t payloadSize){
+			RenderPacket* queued = (RenderPacket*)arena.allocate(sizeof(RenderPacket));
+			*queued = packet;
+			queued->payload = payloadSize ? arena.allocate(payloadSize) : NULL;
+			if(objectCount == maxObjects){
+				if(dropped++ == 0){
+					printf("Render queue full, dropping packets past %d a frame\n", maxObjects);
+				}
+				return queued->payload;
+			}
+			size_t object = frameSize + objectSize*objectCount++;
+			memcpy(mapped + object, &packet.object, sizeof(ObjectUniforms));
+			keys.push_back(key(packet, depth));
+			packets.push_back(queued);
+			objects.push_back(regionOffset + object);
+			return queued->payload;
+		}
+
+		static uint64_t key(const RenderPacket& packet, float depth){
+			depth = depth < 0.0f ? 0.0f : depth > 1.0f ? 1.0f : depth;
+			uint64_t program = packet.program & 0xFFF;
+			uint64_t vertexArray = packet.vertexArray & 0xFFF;
+			uint64_t texture = packet.textureTarget ? (packet.texture & 0xFFFF) : 0;
+			uint64_t quantized = (uint64_t)(depth*0xFFFFFF);
+			return program << 52 | vertexArray << 40 | texture << 24 | quantized;
+		}
+
+		// Sorts and draws every queued packet, then empties the queue and the arena
+		void execute(){
+			uniforms->endWrite();
+			mapped = NULL;
+			sort();
+			glState().bindBufferRange(GL_UNIFORM_BUFFER, RENDER_FRAME_BINDING, uniforms->ID, regionOffset, sizeof(FrameUniforms));
+			for(size_t i = 0; i < order.size(); i++){
+				const RenderPacket* packet = packets[order[i]];
+				glState().useProgram(packet->program);
+				glState().bindVertexArray(packet->vertexArray);
+				if(packet->textureTarget){
+					glState().bindTexture(0, packet->textureTarget, packet->texture);
+				}
+				glState().bindBufferRange(GL_UNIFORM_BUFFER, RENDER_OBJECT_BINDING, uniforms->ID, objects[order[i]], sizeof(ObjectUniforms));
+				packet->draw(packet->payload);
+			}
+			uniforms->fence();
+			executed = (int)order.size();
+			keys.clear();
+			packets.clear();
+			objects.clear();
+			arena.reset();
+		}
+
+	private:
+		std::vector<uint64_t> keys;
+		std::vector<RenderPacket*> packets;
+		// Buffer offset of each packet's object block
+		std::vector<size_t> objects;
+
+		StreamBuffer* uniforms;
+		size_t alignment;
+		size_t frameSize;
+		size_t objectSize;
+		int maxObjects;
+		int objectCount;
+		// The region of the frame being submitted
+		char* mapped;
+		size_t regionOffset;
+		// Packet indices in key order, and scratch for the radix passes
+		std::vector<uint32_t> order;
+		std::vector<uint32_t> scratch;
+
+		size_t alignUp(size_t size){
+			return (size + alignment - 1)/alignment*alignment;
+		}
+
+		// LSD radix sort of packet indices by key, a byte per pass. Passes where every
+		// key has the same byte, like the high depth bits of a flat scene, are skipped.
+		void sort(){
+			size_t count = keys.size();
+			order.resize(count);
+			scratch.resize(count);
+			for(size_t i = 0; i < count; i++){
+				order[i] = (uint32_t)i;
+			}
+			for(int shift = 0; shift < 64; shift += 8){
+				size_t histogram[256] = {0};
+				for(size_t i = 0; i < count; i++){
+					histogram[(keys[i] >> shift) & 0xFF]++;
+				}
+				if(count == 0 || histogram[(keys[0] >> shift) & 0xFF] == count){
+					continue;
+				}
+				size_t offset = 0;
+				for(int digit = 0; digit < 256; digit++){
+					size_t digitCount = histogram[digit];
+					histogram[digit] = offset;
+					offset += digitCount;
+				}
+				for(size_t i = 0; i < count; i++){
+					uint32_t index = order[i];
+					scratch[histogram[(keys[index] >> shift) & 0xFF]++] = index;
+				}
+				order.swap(scratch);
+			}
+		}
+};
+#endif
\ No newline at end of file
@@ -2,96 +2,500 @@
 #define SHADER_H
 
 #include "glad/glad.h"
+#include "glstate.hpp"
+#include "programcache.hpp"
+#include "shadersource.hpp"
+#include "glm/glm.hpp"
+#include "glm/gtc/type_ptr.hpp"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Active uniform of a linked program, arrays are stored under their name without [0]
+struct ShaderUniform{
+	int location;
+	GLenum type;
+	int size;
+};
+
+// Uniform of type T looked up once by name. Location -1 (missing or mismatched) makes every set a no-op.
+template<typename T>
+struct Uniform{
+	int location;
+};
+
+// GL uniform type matching T
+template<typename T> inline GLenum uniformType();
+template<> inline GLenum uniformType<int>(){ return GL_INT; }
+template<> inline GLenum uniformType<unsigned int>(){ return GL_UNSIGNED_INT; }
+template<> inline GLenum uniformType<float>(){ return GL_FLOAT; }
+template<> inline GLenum uniformType<glm::vec2>(){ return GL_FLOAT_VEC2; }
+template<> inline GLenum uniformType<glm::vec3>(){ return GL_FLOAT_VEC3; }
+template<> inline GLenum uniformType<glm::vec4>(){ return GL_FLOAT_VEC4; }
+template<> inline GLenum uniformType<glm::ivec2>(){ return GL_INT_VEC2; }
+template<> inline GLenum uniformType<glm::ivec3>(){ return GL_INT_VEC3; }
+template<> inline GLenum uniformType<glm::ivec4>(){ return GL_INT_VEC4; }
+template<> inline GLenum uniformType<glm::mat3>(){ return GL_FLOAT_MAT3; }
+template<> inline GLenum uniformType<glm::mat4>(){ return GL_FLOAT_MAT4; }
+
+// Samplers and bools are set through int uniforms
+inline bool uniformIsSampler(GLenum type){
+	if(type >= GL_UNSIGNED_INT_VEC2 && type <= GL_UNSIGNED_INT_VEC4){
+		return false;
+	}
+	return (type >= GL_SAMPLER_1D && type <= GL_SAMPLER_2D_RECT_SHADOW) || (type >= GL_SAMPLER_1D_ARRAY && type <= GL_UNSIGNED_INT_SAMPLER_BUFFER)
+		|| (type >= GL_SAMPLER_2D_MULTISAMPLE && type <= GL_UNSIGNED_INT_SAMPLER_2D_MULTISAMPLE_ARRAY);
+}
+
+template<typename T> inline bool uniformTypeMatches(GLenum type){
+	return type == uniformType<T>();
+}
+template<> inline bool uniformTypeMatches<int>(GLenum type){
+	return type == GL_INT || type == GL_BOOL || uniformIsSampler(type);
+}
+
+// count values to the bound program, starting at location
+inline void uniformUpload(int location, const int* values, int count){ glUniform1iv(location, count, values); }
+inline void uniformUpload(int location, const unsigned int* values, int count){ glUniform1uiv(location, count, values); }
+inline void uniformUpload(int location, const float* values, int count){ glUniform1fv(location, count, values); }
+inline void uniformUpload(int location, const glm::vec2* values, int count){ glUniform2fv(location, count, glm::value_ptr(values[0])); }
+inline void uniformUpload(int location, const glm::vec3* values, int count){ glUniform3fv(location, count, glm::value_ptr(values[0])); }
+inline void uniformUpload(int location, const glm::vec4* values, int count){ glUniform4fv(location, count, glm::value_ptr(values[0])); }
+inline void uniformUpload(int location, const glm::ivec2* values, int count){ glUniform2iv(location, count, glm::value_ptr(values[0])); }
+inline void uniformUpload(int location, const glm::ivec3* values, int count){ glUniform3iv(location, count, glm::value_ptr(values[0])); }
+inline void uniformUpload(int location, const glm::ivec4* values, int count){ glUniform4iv(location, count, glm::value_ptr(values[0])); }
+inline void uniformUpload(int location, const glm::mat3* values, int count){ glUniformMatrix3fv(location, count, GL_FALSE, glm::value_ptr(values[0])); }
+inline void uniformUpload(int location, const glm::mat4* values, int count){ glUniformMatrix4fv(location, count, GL_FALSE, glm::value_ptr(values[0])); }
+
+// Program from a vertex and a fragment shader. The active uniforms are read once
+// after linking, so neither handles nor the name based setters ask the driver
+// for a location again. Setters write to the program in use.
 class Shader{
 	public:
 		unsigned int ID;
+		// Bumped by every replace()
+		int version;
 
-		// Constructor for shaders
-		Shader(const char* vertexPath, const char* fragmentPath){
-			char* vertexCode; 
-			char* fragmentCode;
-			FILE* vertexFile = fopen(vertexPath, "r");
-			FILE* fragmentFile = fopen(fragmentPath, "r");
-
-			if(vertexFile == NULL && fragmentFile == NULL){
-				printf("Files does not exist!");
-				exit(-1);
-			}
-			size_t newLen = fread(vertexCode, sizeof(char), sizeof(vertexCode), vertexFile);
-			if(ferror(vertexFile) != 0){
-				fputs("Error reading file!", stderr);
-			}
-			else{
-				vertexCode[newLen++] = '\0';
+		// Program from two shader files, see ShaderSource for includes and defines. ID is 0 when loading, compiling or linking failed.
+		Shader(const char* vertexPath, const char* fragmentPath, const char* defines = NULL){
+			ID = 0;
+			version = 0;
+			ShaderSource vertex, fragment;
+			if(vertex.load(vertexPath, defines) && fragment.load(fragmentPath, defines)){
+				build(vertex.code.c_str(), fragment.code.c_str());
 			}
+		}
 
-			newLen = fread(fragmentCode, sizeof(char), sizeof(fragmentCode), fragmentFile);
-			if(ferror(fragmentFile) != 0){
-				fputs("Error reading file!", stderr);
-			}
-			else{
-				fragmentCode[newLen++] = '\0';
+		~Shader(){
+			if(ID){
+				glDeleteProgram(ID);
+				glState().forgetProgram(ID);
 			}
-			fclose(vertexFile);
-			fclose(fragmentFile);
+		}
 
-			unsigned int vertex, fragment;
-			int success;
-			char infoLog[512];
+		// Program from source strings, ID is 0 when compiling or linking failed.
+		// With a cache the binary is loaded when present and stored after compiling otherwise.
+		static Shader* fromSource(const char* vertexSource, const char* fragmentSource, ProgramCache* cache = NULL){
+			Shader* shader = new Shader();
+			shader->build(vertexSource, fragmentSource, cache);
+			return shader;
+		}
 
-			vertex = glCreateShader(GL_VERTEX_SHADER);
+		void use(){
+			glState().useProgram(ID);
+		}
+
+		// Compiles and links a program without asking for the result, so with parallel shader
+		// compile the driver can finish it in the background. Check it with linked().
+		static unsigned int link(const char* vertexCode, const char* fragmentCode, ProgramCache* cache = NULL){
+			unsigned int vertex = glCreateShader(GL_VERTEX_SHADER);
 			glShaderSource(vertex, 1, &vertexCode, NULL);
 			glCompileShader(vertex);
 
-			glGetShaderiv(vertex, GL_COMPILE_STATUS, &success);
-			if(!success){
-				glGetShaderInfoLog(vertex, 512, NULL, infoLog);
-				printf("ERROR::SHADER::VERTEX::COMPILATION_FAILED\n%s", infoLog);
-			}
-
-			fragment = glCreateShader(GL_FRAGMENT_SHADER);
+			unsigned int fragment = glCreateShader(GL_FRAGMENT_SHADER);
 			glShaderSource(fragment, 1, &fragmentCode, NULL);
 			glCompileShader(fragment);
 
-			glGetShaderiv(fragment, GL_COMPILE_STATUS, &success);
-			if(!success){
-				glGetShaderInfoLog(fragment, 512, NULL, infoLog);
-				printf("ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n%s", infoLog);
+			unsigned int program = glCreateProgram();
+			glAttachShader(program, vertex);
+			glAttachShader(program, fragment);
+			if(cache){
+				cache->prepare(program);
+			}
+			glLinkProgram(program);
+
+			// Stay attached, and readable by linked(), until the program is deleted
+			glDeleteShader(vertex);
+			glDeleteShader(fragment);
+			return program;
+		}
+
+		// Waits for a program from link() and prints the compile and link errors when it failed
+		static bool linked(unsigned int program){
+			int success;
+			char infoLog[512];
+			glGetProgramiv(program, GL_LINK_STATUS, &success);
+			if(success){
+				return true;
+			}
+			unsigned int shaders[2];
+			GLsizei count = 0;
+			glGetAttachedShaders(program, 2, &count, shaders);
+			for(int i = 0; i < count; i++){
+				int type;
+				glGetShaderiv(shaders[i], GL_COMPILE_STATUS, &success);
+				glGetShaderiv(shaders[i], GL_SHADER_TYPE, &type);
+				if(!success){
+					glGetShaderInfoLog(shaders[i], 512, NULL, infoLog);
+					printf("ERROR::SHADER::%s::COMPILATION_FAILED\n%s", type == GL_VERTEX_SHADER ? "VERTEX" : "FRAGMENT", infoLog);
+				}
+			}
+			glGetProgramInfoLog(program, 512, NULL, infoLog);
+			printf("ERROR::SHADER::PROGRAM::LINKING_FAILED\n%s\n", infoLog);
+			return false;
+		}
+
+		// Takes over a linked program in place of the current one, which is deleted. Values of
+		// non-array uniforms present in both carry over; handles must be looked up again, which
+		// version tells. The new program is left in use.
+		void replace(unsigned int program){
+			std::unordered_map<std::string, ShaderUniform> previous;
+			previous.swap(uniforms);
+			unsigned int old = ID;
+			ID = program;
+			cacheUniforms();
+			for(std::unordered_map<std::string, unsigned int>::iterator it = blockBindings.begin(); it != blockBindings.end(); it++){
+				bindBlock(it->first.c_str(), it->second);
+			}
+			glState().useProgram(ID);
+			for(std::unordered_map<std::string, ShaderUniform>::iterator it = uniforms.begin(); it != uniforms.end(); it++){
+				std::unordered_map<std::string, ShaderUniform>::iterator from = previous.find(it->first);
+				if(from != previous.end() && from->second.type == it->second.type && it->second.size == 1 && from->second.size == 1){
+					copyUniform(old, from->second.location, it->second);
+				}
+			}
+			glDeleteProgram(old);
+			version++;
+		}
+
+		// Points the uniform block name at binding, also in programs taken over by replace().
+		// Returns false when the program has no such active block.
+		bool bindBlock(const char* name, unsigned int binding){
+			blockBindings[name] = binding;
+			unsigned int index = glGetUniformBlockIndex(ID, name);
+			if(index == GL_INVALID_INDEX){
+				return false;
 			}
+			glUniformBlockBinding(ID, index, binding);
+			return true;
+		}
 
-			ID = glCreateProgram();
-			glAttachShader(ID, vertex);
-			glAttachShader(ID, fragment);
-			glLinkProgram(ID);
+		// NULL for names that are not active uniforms
+		const ShaderUniform* find(const char* name){
+			std::unordered_map<std::string, ShaderUniform>::const_iterator it = uniforms.find(name);
+			return it == uniforms.end() ? NULL : &it->second;
+		}
 
-			glGetProgramiv(ID, GL_LINK_STATUS, &success);
-			if(!success){
-				glGetProgramInfoLog(ID, 512, NULL, infoLog);
-				printf("ERROR::SHADER::PROGRAM::LINKING_FAILED\n%s", infoLog);
+		// Typed handle for name, warns and returns location -1 when the GLSL type is not T
+		template<typename T>
+		Uniform<T> uniform(const char* name){
+			Uniform<T> handle = {-1};
+			const ShaderUniform* found = find(name);
+			if(found == NULL){
+				return handle;
 			}
+			if(!uniformTypeMatches<T>(found->type)){
+				printf("Uniform %s has GL type 0x%04X, not 0x%04X\n", name, found->type, uniformType<T>());
+				return handle;
+			}
+			handle.location = found->location;
+			return handle;
+		}
 
-			glDeleteShader(vertex);
-			glDeleteShader(fragment);
+		template<typename T>
+		void set(Uniform<T> uniform, const T& value){
+			uniformUpload(uniform.location, &value, 1);
 		}
 
-		void use(){
-			glUseProgram(ID);
+		// count elements of an array uniform from its first element
+		template<typename T>
+		void set(Uniform<T> uniform, const T* values, int count){
+			uniformUpload(uniform.location, values, count);
 		}
 
 		void setBool(const char* name, bool value){
-			glUniform1i(glGetUniformLocation(ID, name), (int)value);
+			glUniform1i(location(name), (int)value);
 		}
 
 		void setInt(const char* name, int value){
-			glUniform1i(glGetUniformLocation(ID, name), (int)value);
+			glUniform1i(location(name), (int)value);
 		}
 
 		void setFloat(const char* name, float value){
-			glUniform1f(glGetUniformLocation(ID, name), (float)value);
+			glUniform1f(location(name), (float)value);
+		}
+
+	private:
+		std::unordered_map<std::string, ShaderUniform> uniforms;
+		std::unordered_map<std::string, unsigned int> blockBindings;
+
+		Shader(){
+			ID = 0;
+			version = 0;
+		}
+
+		int location(const char* name){
+			const ShaderUniform* found = find(name);
+			return found ? found->location : -1;
+		}
+
+		void build(const char* vertexCode, const char* fragmentCode, ProgramCache* cache = NULL){
+			if(cache){
+				ID = cache->load(vertexCode, fragmentCode);
+				if(ID){
+					cacheUniforms();
+					return;
+				}
+			}
+
+			ID = link(vertexCode, fragmentCode, cache);
+			if(!linked(ID)){
+				glDeleteProgram(ID);
+				ID = 0;
+				return;
+			}
+
+			if(cache){
+				cache->store(ID, vertexCode, fragmentCode);
+			}
+			cacheUniforms();
+		}
+
+		// Value of the uniform at location in program to the same uniform of the program in use
+		static void copyUniform(unsigned int program, int location, const ShaderUniform& to){
+			union{
+				float f[16];
+				int i[16];
+				unsigned int u[16];
+			} value;
+			switch(to.type){
+				case GL_FLOAT:
+					glGetUniformfv(program, location, value.f);
+					glUniform1fv(to.location, 1, value.f);
+					break;
+				case GL_FLOAT_VEC2:
+					glGetUniformfv(program, location, value.f);
+					glUniform2fv(to.location, 1, value.f);
+					break;
+				case GL_FLOAT_VEC3:
+					glGetUniformfv(program, location, value.f);
+					glUniform3fv(to.location, 1, value.f);
+					break;
+				case GL_FLOAT_VEC4:
+					glGetUniformfv(program, location, value.f);
+					glUniform4fv(to.location, 1, value.f);
+					break;
+				case GL_FLOAT_MAT3:
+					glGetUniformfv(program, location, value.f);
+					glUniformMatrix3fv(to.location, 1, GL_FALSE, value.f);
+					break;
+				case GL_FLOAT_MAT4:
+					glGetUniformfv(program, location, value.f);
+					glUniformMatrix4fv(to.location, 1, GL_FALSE, value.f);
+					break;
+				case GL_INT_VEC2:
+					glGetUniformiv(program, location, value.i);
+					glUniform2iv(to.location, 1, value.i);
+					break;
+				case GL_INT_VEC3:
+					glGetUniformiv(program, location, value.i);
+					glUniform3iv(to.location, 1, value.i);
+					break;
+				case GL_INT_VEC4:
+					glGetUniformiv(program, location, value.i);
+					glUniform4iv(to.location, 1, value.i);
+					break;
+				case GL_UNSIGNED_INT:
+					glGetUniformuiv(program, location, value.u);
+					glUniform1uiv(to.location, 1, value.u);
+					break;
+				default:
+					if(uniformTypeMatches<int>(to.type)){
+						glGetUniformiv(program, location, value.i);
+						glUniform1iv(to.location, 1, value.i);
+					}
+					break;
+			}
+		}
+
+		// One pass over GL_ACTIVE_UNIFORMS, the only place locations are queried
+		void cacheUniforms(){
+			uniforms.clear();
+			int count = 0, maxLength = 0;
+			glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+			glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+			std::string name(maxLength > 0 ? maxLength : 1, '\0');
+			for(int i = 0; i < count; i++){
+				GLsizei length = 0;
+				ShaderUniform uniform;
+				glGetActiveUniform(ID, i, (GLsizei)name.size(), &length, &uniform.size, &uniform.type, &name[0]);
+				std::string key(name.c_str(), length);
+				uniform.location = glGetUniformLocation(ID, key.c_str());
+				// Uniform block members have no location
+				if(uniform.location < 0){
+					continue;
+				}
+				if(key.size() > 3 && key.compare(key.size() - 3, 3, "[0]") == 0){
+					key.resize(key.size() - 3);
+				}
+				uniforms[key] = uniform;
+			}
+		}
+};
+
+// Programs built from shader files in a directory, keyed by a hash of the expanded
+// sources. A variant that expands to the code of an earlier one (the same files and
+// defines, or identical files) shares its program instead of compiling again.
+// Owns the programs it returns.
+class ShaderVariants{
+	public:
+		std::string directory;
+		// Programs compiled or loaded, and requests answered with an existing program
+		int built;
+		int reused;
+
+		ShaderVariants(const char* directory, ProgramCache* cache = NULL){
+			this->directory = directory;
+			this->cache = cache;
+			built = 0;
+			reused = 0;
+		}
+
+		~ShaderVariants(){
+			for(std::unordered_map<uint64_t, Variant>::iterator it = variants.begin(); it != variants.end(); it++){
+				delete it->second.shader;
+			}
+			for(size_t i = 0; i < collisions.size(); i++){
+				delete collisions[i];
+			}
+		}
+
+		// Paths are relative to directory and defines apply to both stages. NULL when the program failed to load, compile or link.
+		Shader* get(const char* vertexPath, const char* fragmentPath, const char* defines = NULL){
+			ShaderSource vertex, fragment;
+			if(!vertex.load(path(vertexPath).c_str(), defines) || !fragment.load(path(fragmentPath).c_str(), defines)){
+				return NULL;
+			}
+			uint64_t key = programCacheHash(vertex.code.c_str(), vertex.code.size() + 1);
+			key = programCacheHash(fragment.code.c_str(), fragment.code.size() + 1, key);
+			std::unordered_map<uint64_t, Variant>::iterator it = variants.find(key);
+			if(it != variants.end() && it->second.vertexCode == vertex.code && it->second.fragmentCode == fragment.code){
+				reused++;
+				return it->second.shader;
+			}
+
+			Shader* shader = Shader::fromSource(vertex.code.c_str(), fragment.code.c_str(), cache);
+			if(!shader->ID){
+				printSources("vertex", vertex);
+				printSources("fragment", fragment);
+				delete shader;
+				return NULL;
+			}
+			built++;
+			// On a hash collision the first variant stays cached
+			if(it == variants.end()){
+				Variant variant = {vertexPath, fragmentPath, defines ? defines : "", vertex.code, fragment.code, shader, {}};
+				addFiles(variant, vertex, fragment);
+				variants[key] = variant;
+			}
+			else{
+				collisions.push_back(shader);
+			}
+			return shader;
+		}
+
+		// Every file read by a variant, includes too
+		void files(std::vector<std::string>& paths){
+			paths.clear();
+			for(std::unordered_map<uint64_t, Variant>::iterator it = variants.begin(); it != variants.end(); it++){
+				for(size_t i = 0; i < it->second.files.size(); i++){
+					if(std::find(paths.begin(), paths.end(), it->second.files[i]) == paths.end()){
+						paths.push_back(it->second.files[i]);
+					}
+				}
+			}
+		}
+
+		// Programs of the variants that read path
+		void dependents(const std::string& path, std::vector<Shader*>& shaders){
+			for(std::unordered_map<uint64_t, Variant>::iterator it = variants.begin(); it != variants.end(); it++){
+				const std::vector<std::string>& files = it->second.files;
+				if(std::find(files.begin(), files.end(), path) != files.end() && std::find(shaders.begin(), shaders.end(), it->second.shader) == shaders.end()){
+					shaders.push_back(it->second.shader);
+				}
+			}
+		}
+
+		// Expands the sources of the variant built into shader again, for rebuilding it after its files changed
+		bool reread(Shader* shader, ShaderSource& vertex, ShaderSource& fragment){
+			for(std::unordered_map<uint64_t, Variant>::iterator it = variants.begin(); it != variants.end(); it++){
+				Variant& variant = it->second;
+				if(variant.shader != shader){
+					continue;
+				}
+				const char* defines = variant.defines.c_str();
+				if(!vertex.load(path(variant.vertexPath.c_str()).c_str(), defines) || !fragment.load(path(variant.fragmentPath.c_str()).c_str(), defines)){
+					return false;
+				}
+				// Keyed by the code it was first built from, later requests for the new code build it again
+				variant.vertexCode = vertex.code;
+				variant.fragmentCode = fragment.code;
+				addFiles(variant, vertex, fragment);
+				return true;
+			}
+			return false;
+		}
+
+	private:
+		struct Variant{
+			std::string vertexPath;
+			std::string fragmentPath;
+			std::string defines;
+			std::string vertexCode;
+			std::string fragmentCode;
+			Shader* shader;
+			std::vector<std::string> files;
+		};
+
+		ProgramCache* cache;
+		std::unordered_map<uint64_t, Variant> variants;
+		// Programs built for a variant whose key was taken, owned but not cached
+		std::vector<Shader*> collisions;
+
+		std::string path(const char* name){
+			return directory.empty() ? std::string(name) : directory + "/" + name;
+		}
+
+		static void addFiles(Variant& variant, const ShaderSource& vertex, const ShaderSource& fragment){
+			variant.files = vertex.files;
+			for(size_t i = 0; i < fragment.files.size(); i++){
+				if(std::find(variant.files.begin(), variant.files.end(), fragment.files[i]) == variant.files.end()){
+					variant.files.push_back(fragment.files[i]);
+				}
+			}
+		}
+
+		// Source string numbers in compiler messages to files
+		static void printSources(const char* stage, const ShaderSource& source){
+			for(size_t i = 0; i < source.files.size(); i++){
+				printf("  %s source %d: %s\n", stage, (int)i, source.files[i].c_str());
+			}
 		}
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,280 @@
+#ifndef SHADERRELOAD_H
+#define SHADERRELOAD_H
+
+#include "glad/glad.h"
+#include <GLFW/glfw3.h>
+#include "shader.hpp"
+
+#include <stdio.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+// Rebuilds the programs of a ShaderVariants when their files change, without blocking
+// a frame. inotify reports writes in the directories of every file a variant reads,
+// includes too. Programs are built by a thread on a context shared with the render
+// context. Without one, KHR or ARB_parallel_shader_compile lets the driver compile in
+// the background and poll() checks GL_COMPLETION_STATUS; Mesa still links on the
+// calling thread there, so the worker is preferred. Either way poll(), called at the
+// start of a frame, is the only place programs are swapped, and a program that fails
+// to compile or link is dropped so the old one keeps drawing.
+class ShaderReloader{
+	public:
+		// Programs swapped in and builds that failed
+		int reloads;
+		int failures;
+
+		// context is a hidden window sharing objects with the current one, NULL falls back to parallel shader compile
+		ShaderReloader(ShaderVariants* variants, GLFWwindow* context = NULL){
+			this->variants = variants;
+			this->context = context;
+			reloads = 0;
+			failures = 0;
+			stopping = false;
+			parallel = false;
+			watcher = -1;
+#ifdef __linux__
+			watcher = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+			if(watcher < 0){
+				printf("Shader hot reload needs inotify, disabled\n");
+				return;
+			}
+			if(context){
+				worker = std::thread(&ShaderReloader::workerLoop, this);
+			}
+			else if(GLAD_GL_KHR_parallel_shader_compile){
+				glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+				parallel = true;
+			}
+			else if(GLAD_GL_ARB_parallel_shader_compile){
+				glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+				parallel = true;
+			}
+			else{
+				printf("Shader hot reload compiles on the render thread, frames will hitch\n");
+			}
+			watchFiles();
+		}
+
+		~ShaderReloader(){
+			if(worker.joinable()){
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					stopping = true;
+				}
+				wake.notify_all();
+				worker.join();
+			}
+			for(size_t i = 0; i < compiling.size(); i++){
+				glDeleteProgram(compiling[i].program);
+			}
+			for(size_t i = 0; i < finished.size(); i++){
+				glDeleteProgram(finished[i].program);
+			}
+#ifdef __linux__
+			if(watcher >= 0){
+				close(watcher);
+			}
+#endif
+		}
+
+		bool enabled(){
+			return watcher >= 0;
+		}
+
+		// Starts builds for changed files and swaps in the programs that are done,
+		// true when some program changed and its uniform handles must be looked up again
+		bool poll(){
+			if(!enabled()){
+				return false;
+			}
+			std::vector<Shader*> changed;
+			readEvents(changed);
+			for(size_t i = 0; i < changed.size(); i++){
+				start(changed[i]);
+			}
+
+			std::vector<Job> done;
+			if(worker.joinable()){
+				std::lock_guard<std::mutex> lock(mutex);
+				done.swap(finished);
+			}
+			else{
+				// In order, so an older build of a program never lands after a newer one
+				while(!compiling.empty() && complete(compiling.front().program)){
+					done.push_back(compiling.front());
+					compiling.pop_front();
+				}
+			}
+
+			bool swapped = false;
+			for(size_t i = 0; i < done.size(); i++){
+				if(done[i].program && (worker.joinable() || Shader::linked(done[i].program))){
+					done[i].shader->replace(done[i].program);
+					reloads++;
+					swapped = true;
+					printf("Reloaded shader program %u\n", done[i].program);
+				}
+				else{
+					glDeleteProgram(done[i].program);
+					failures++;
+					printf("Shader reload failed, keeping the previous program\n");
+				}
+			}
+			return swapped;
+		}
+
+	private:
+		struct Job{
+			Shader* shader;
+			unsigned int program;
+			std::string vertexCode;
+			std::string fragmentCode;
+		};
+
+		ShaderVariants* variants;
+		GLFWwindow* context;
+		int watcher;
+		// Watched directories by inotify watch descriptor, with a trailing slash
+		std::vector<std::pair<int, std::string>> directories;
+
+		// No worker: programs linking in the driver, oldest first
+		bool parallel;
+		std::deque<Job> compiling;
+
+		// Worker context: jobs waiting for the worker and programs it has built
+		std::thread worker;
+		std::mutex mutex;
+		std::condition_variable wake;
+		std::deque<Job> queued;
+		std::vector<Job> finished;
+		bool stopping;
+
+		// Adds a watch for every directory holding a file of some variant
+		void watchFiles(){
+#ifdef __linux__
+			std::vector<std::string> files;
+			variants->files(files);
+			for(size_t i = 0; i < files.size(); i++){
+				size_t slash = files[i].find_last_of('/');
+				std::string directory = slash == std::string::npos ? std::string() : files[i].substr(0, slash + 1);
+				bool watched = false;
+				for(size_t j = 0; j < directories.size(); j++){
+					watched = watched || directories[j].second == directory;
+				}
+				if(watched){
+					continue;
+				}
+				// Editors either rewrite a file or rename a new one over it
+				int descriptor = inotify_add_watch(watcher, directory.empty() ? "." : directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+				if(descriptor < 0){
+					printf("Failed to watch %s for shader changes\n", directory.empty() ? "." : directory.c_str());
+					continue;
+				}
+				directories.push_back(std::make_pair(descriptor, directory));
+			}
+#endif
+		}
+
+		// Programs depending on the files written since the last call
+		void readEvents(std::vector<Shader*>& changed){
+#ifdef __linux__
+			alignas(struct inotify_event) char buffer[4096];
+			while(true){
+				ssize_t length = read(watcher, buffer, sizeof(buffer));
+				if(length <= 0){
+					break;
+				}
+				for(char* at = buffer; at < buffer + length; ){
+					struct inotify_event* event = (struct inotify_event*)at;
+					at += sizeof(struct inotify_event) + event->len;
+					if(event->len == 0){
+						continue;
+					}
+					for(size_t i = 0; i < directories.size(); i++){
+						if(directories[i].first == event->wd){
+							variants->dependents(directories[i].second + event->name, changed);
+						}
+					}
+				}
+			}
+#endif
+		}
+
+		void start(Shader* shader){
+			ShaderSource vertex, fragment;
+			if(!variants->reread(shader, vertex, fragment)){
+				failures++;
+				printf("Shader reload failed, keeping the previous program\n");
+				return;
+			}
+			// An include may have been added
+			watchFiles();
+			if(worker.joinable()){
+				Job job = {shader, 0, vertex.code, fragment.code};
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					queued.push_back(job);
+				}
+				wake.notify_one();
+				return;
+			}
+			// A newer build replaces one still compiling
+			for(size_t i = 0; i < compiling.size(); i++){
+				if(compiling[i].shader == shader){
+					glDeleteProgram(compiling[i].program);
+					compiling.erase(compiling.begin() + i);
+					break;
+				}
+			}
+			Job job = {shader, Shader::link(vertex.code.c_str(), fragment.code.c_str()), "", ""};
+			compiling.push_back(job);
+		}
+
+		// Without parallel compile every program is complete once link() returns
+		bool complete(unsigned int program){
+			if(!parallel){
+				return true;
+			}
+			int done = 0;
+			glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &done);
+			return done != 0;
+		}
+
+		void workerLoop(){
+			glfwMakeContextCurrent(context);
+			while(true){
+				Job job;
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					wake.wait(lock, [this]{ return stopping || !queued.empty(); });
+					if(stopping){
+						break;
+					}
+					job = queued.front();
+					queued.pop_front();
+				}
+				job.program = Shader::link(job.vertexCode.c_str(), job.fragmentCode.c_str());
+				if(!Shader::linked(job.program)){
+					glDeleteProgram(job.program);
+					job.program = 0;
+				}
+				// The render context may only use the program once it is complete
+				glFinish();
+				std::lock_guard<std::mutex> lock(mutex);
+				finished.push_back(job);
+			}
+			glfwMakeContextCurrent(NULL);
+		}
+};
+#endif
\ No newline at end of file
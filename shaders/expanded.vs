@@ -0,0 +1,26 @@
+#version 330 core
+// Expanded grid, 4 vertices per cell.
+// PACKED_POSITION: uint16 corners, offset by half a cell. Otherwise float positions.
+// TEXCOORD: passes texture coordinates on.
+#include "grid.glsl"
+#ifdef PACKED_POSITION
+layout (location = 0) in vec2 aCorner;
+#else
+layout (location = 0) in vec3 aPos;
+#endif
+layout (location = 1) in vec4 aColor;
+#ifdef TEXCOORD
+layout (location = 2) in vec2 aTexCoord;
+out vec2 texCoord;
+#endif
+void main(){
+#ifdef PACKED_POSITION
+	gl_Position = transform(vec4(aCorner - 0.5, 0.0, 1.0));
+#else
+	gl_Position = transform(vec4(aPos, 1.0));
+#endif
+	color = aColor.rgb;
+#ifdef TEXCOORD
+	texCoord = aTexCoord;
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,12 @@
+#version 330 core
+in vec3 color;
+in vec2 texCoord;
+out vec4 FragColor;
+uniform sampler2D image;
+void main(){
+#ifdef TEXTURE
+	FragColor = vec4(color, 1.0f) * texture(image, texCoord);
+#else
+	FragColor = vec4(color, 1.0f);
+#endif
+}
\ No newline at end of file
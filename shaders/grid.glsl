@@ -0,0 +1,20 @@
+// Shared by the grid vertex shaders, included after #version
+out vec3 color;
+
+// std140 mirrors of FrameUniforms and ObjectUniforms, bound by RenderQueue with glBindBufferRange
+layout(std140) uniform FrameBlock{
+	mat4 viewProjection;
+	float time;
+};
+layout(std140) uniform ObjectBlock{
+	mat4 model;
+};
+
+// Grid units to clip space
+vec4 transform(vec4 position){
+	return viewProjection * (model * position);
+}
+
+// Two triangles per cell, corner cornerIndex[gl_VertexID % 6] around the cell center
+const int cornerIndex[6] = int[6](0, 1, 3, 1, 2, 3);
+const vec2 corners[4] = vec2[4](vec2(0.5, 0.5), vec2(0.5, -0.5), vec2(-0.5, -0.5), vec2(-0.5, 0.5));
\ No newline at end of file
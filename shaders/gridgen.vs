@@ -0,0 +1,65 @@
+#version 330 core
+// Grid generation on the GPU: one vertex per output record, no inputs, rasterization off.
+// Transform feedback captures word0.. into a cell stream region, laid out byte for byte
+// like generateInstanceRows and expandVertices in gridgen.hpp write it on the CPU.
+// INSTANCE writes a GridInstance per cell; FLOAT_VERTEX, PACKED_VERTEX, PACKED_UV_VERTEX
+// and VERTEXID_VERTEX write 4 vertices per cell in that vertex format.
+uniform uint seed;
+uniform int gridSize;
+flat out uint word0;
+flat out uint word1;
+flat out uint word2;
+flat out uint word3;
+flat out uint word4;
+flat out uint word5;
+flat out uint word6;
+flat out uint word7;
+
+// Corner offsets in the order expandInstances writes them: (1,1) (1,0) (0,0) (0,1)
+const uint cornerX[4] = uint[4](1u, 1u, 0u, 0u);
+const uint cornerY[4] = uint[4](1u, 0u, 0u, 1u);
+
+// gridHash
+uint gridHash(uint seed, uint counter){
+	uint x = counter + seed * 0x9E3779B9u;
+	x ^= x >> 16;
+	x *= 0x7FEB352Du;
+	x ^= x >> 15;
+	x *= 0x846CA68Bu;
+	x ^= x >> 16;
+	return x;
+}
+
+void main(){
+#ifdef INSTANCE
+	uint cell = uint(gl_VertexID);
+	uint corner = 0u;
+#else
+	uint cell = uint(gl_VertexID) / 4u;
+	uint corner = uint(gl_VertexID) % 4u;
+#endif
+	uint x = cell % uint(gridSize);
+	uint y = cell / uint(gridSize);
+	uint color = gridHash(seed, cell) | 0xFF000000u;
+#if defined(INSTANCE)
+	word0 = x | y << 16;
+	word1 = color;
+#elif defined(FLOAT_VERTEX)
+	vec2 position = vec2(x, y) + (vec2(cornerX[corner], cornerY[corner]) - 0.5);
+	vec3 rgb = vec3(uvec3(color, color >> 8, color >> 16) & 0xFFu) * (1.0 / 255.0);
+	word0 = floatBitsToUint(position.x);
+	word1 = floatBitsToUint(position.y);
+	word2 = 0u;
+	word3 = floatBitsToUint(rgb.r);
+	word4 = floatBitsToUint(rgb.g);
+	word5 = floatBitsToUint(rgb.b);
+	word6 = floatBitsToUint(float(cornerX[corner]));
+	word7 = floatBitsToUint(float(cornerY[corner]));
+#elif defined(PACKED_VERTEX) || defined(PACKED_UV_VERTEX)
+	word0 = (x + cornerX[corner]) | (y + cornerY[corner]) << 16;
+	word1 = color;
+	word2 = cornerX[corner]*0xFFFFu | cornerY[corner]*0xFFFFu << 16;
+#else
+	word0 = color;
+#endif
+}
\ No newline at end of file
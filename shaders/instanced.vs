@@ -0,0 +1,10 @@
+#version 330 core
+// Instanced grid: one unit quad, expanded per cell
+#include "grid.glsl"
+layout (location = 0) in vec2 aCorner;
+layout (location = 1) in vec2 aCell;
+layout (location = 2) in vec4 aColor;
+void main(){
+	gl_Position = transform(vec4(aCell + aCorner, 0.0, 1.0));
+	color = aColor.rgb;
+}
\ No newline at end of file
@@ -0,0 +1,19 @@
+#version 330 core
+// Level of detail grid: one instance per quadtree node, tileSize x tileSize quads from gl_VertexID.
+// A quad is one texel of the node's level in the color pyramid and covers 2^level cells per side.
+#include "grid.glsl"
+layout (location = 1) in uvec3 aNode;
+uniform sampler2D colors;
+uniform int gridSize;
+uniform int tileSize;
+void main(){
+	int quad = gl_VertexID / 6;
+	int level = int(aNode.z);
+	ivec2 texel = ivec2(aNode.xy) + ivec2(quad % tileSize, quad / tileSize);
+	int levelSize = (gridSize + (1 << level) - 1) >> level;
+	// Texels past the edge of the grid collapse to a point, corners are moved to [0, 1]
+	vec2 corner = all(lessThan(texel, ivec2(levelSize))) ? corners[cornerIndex[gl_VertexID % 6]] + 0.5 : vec2(0.0);
+	vec2 position = min((vec2(texel) + corner)*float(1 << level), vec2(gridSize)) - 0.5;
+	gl_Position = transform(vec4(position, 0.0, 1.0));
+	color = texelFetch(colors, texel, level).rgb;
+}
\ No newline at end of file
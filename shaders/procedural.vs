@@ -0,0 +1,12 @@
+#version 330 core
+// Procedural grid: no vertex or index buffer, 6 vertices per cell from gl_VertexID.
+// Cell position and color are fetched from the instance stream through a buffer texture.
+#include "grid.glsl"
+uniform usamplerBuffer cells;
+uniform int cellBase;
+void main(){
+	uvec2 cell = texelFetch(cells, cellBase + gl_VertexID / 6).xy;
+	vec2 position = vec2(cell.x & 0xFFFFu, cell.x >> 16) + corners[cornerIndex[gl_VertexID % 6]];
+	gl_Position = transform(vec4(position, 0.0, 1.0));
+	color = vec3(cell.y & 0xFFu, (cell.y >> 8) & 0xFFu, (cell.y >> 16) & 0xFFu) / 255.0;
+}
\ No newline at end of file
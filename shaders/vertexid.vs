@@ -0,0 +1,11 @@
+#version 330 core
+// Expanded grid with colors only. Indexed draws see the index as gl_VertexID: cell*4 + corner
+#include "grid.glsl"
+layout (location = 1) in vec4 aColor;
+uniform int gridSize;
+void main(){
+	int cell = gl_VertexID >> 2;
+	vec2 position = vec2(cell % gridSize, cell / gridSize) + corners[gl_VertexID & 3];
+	gl_Position = transform(vec4(position, 0.0, 1.0));
+	color = aColor.rgb;
+}
\ No newline at end of file
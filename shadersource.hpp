@@ -0,0 +1,172 @@
+#ifndef SHADERSOURCE_H
+#define SHADERSOURCE_H
+
+#include "mappedfile.hpp"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+// GLSL source expanded from a file. Lines of the form #include "name" are replaced by
+// that file, found next to the file including it; a file is included once per source,
+// so repeated or circular includes are skipped. Defines are injected right after
+// #version. #line directives keep compiler messages pointing at the original lines,
+// with files[n] the file of source string number n.
+//
+// Files are mapped only while load() runs and copied straight into code, the one
+// buffer handed to glShaderSource. #include is resolved before the GLSL preprocessor
+// runs, so it is not affected by #if blocks.
+class ShaderSource{
+	public:
+		std::string code;
+		std::vector<std::string> files;
+
+		// defines is a comma separated list of NAME or NAME=VALUE, may be NULL
+		bool load(const char* path, const char* defines = NULL){
+			code.clear();
+			files.clear();
+			return expand(path, defines, true);
+		}
+
+	private:
+		bool expand(const std::string& path, const char* defines, bool root){
+			MappedFile file(path.c_str());
+			if(file.data == NULL){
+				printf("Failed to open shader source %s\n", path.c_str());
+				return false;
+			}
+			int source = (int)files.size();
+			files.push_back(path);
+			code.reserve(code.size() + file.size);
+
+			const char* end = file.data + file.size;
+			const char* line = file.data;
+			// Start of the lines not copied yet, copied in one piece up to the next directive
+			const char* pending = line;
+			int number = 1;
+			bool versioned = false;
+			if(!root){
+				appendLine(1, source);
+			}
+			while(line < end){
+				const char* next = (const char*)memchr(line, '\n', end - line);
+				next = next ? next + 1 : end;
+				const char* directive = skipBlanks(line, next);
+				if(directive < next && *directive == '#'){
+					const char* word = skipBlanks(directive + 1, next);
+					if(root && startsWith(word, next, "version")){
+						code.append(pending, next - pending);
+						endLine();
+						code += defineLines(defines);
+						appendLine(number + 1, source);
+						pending = next;
+						versioned = true;
+					}
+					else if(startsWith(word, next, "include")){
+						std::string name;
+						if(!includeName(word + 7, next, name)){
+							printf("%s:%d: expected #include \"file\"\n", path.c_str(), number);
+							return false;
+						}
+						code.append(pending, line - pending);
+						std::string included = directoryOf(path) + name;
+						if(!seen(included)){
+							if(!expand(included, NULL, false)){
+								return false;
+							}
+							endLine();
+							appendLine(number + 1, source);
+						}
+						else{
+							// Keeps the line numbers after it
+							code += '\n';
+						}
+						pending = next;
+					}
+				}
+				line = next;
+				number++;
+			}
+			code.append(pending, end - pending);
+			// Without #version the defines can go first
+			if(root && !versioned && defines && *defines){
+				code.insert(0, defineLines(defines) + "#line 1 0\n");
+			}
+			return true;
+		}
+
+		bool seen(const std::string& path){
+			for(size_t i = 0; i < files.size(); i++){
+				if(files[i] == path){
+					return true;
+				}
+			}
+			return false;
+		}
+
+		void endLine(){
+			if(!code.empty() && code[code.size() - 1] != '\n'){
+				code += '\n';
+			}
+		}
+
+		void appendLine(int number, int source){
+			char directive[32];
+			snprintf(directive, sizeof(directive), "#line %d %d\n", number, source);
+			code += directive;
+		}
+
+		static std::string defineLines(const char* defines){
+			std::string lines;
+			while(defines && *defines){
+				const char* end = strchr(defines, ',');
+				if(end == NULL){
+					end = defines + strlen(defines);
+				}
+				std::string define(defines, end - defines);
+				size_t equals = define.find('=');
+				if(equals != std::string::npos){
+					define[equals] = ' ';
+				}
+				if(!define.empty()){
+					lines += "#define " + define + "\n";
+				}
+				defines = *end ? end + 1 : end;
+			}
+			return lines;
+		}
+
+		static const char* skipBlanks(const char* text, const char* end){
+			while(text < end && (*text == ' ' || *text == '\t')){
+				text++;
+			}
+			return text;
+		}
+
+		static bool startsWith(const char* text, const char* end, const char* word){
+			size_t length = strlen(word);
+			return (size_t)(end - text) >= length && memcmp(text, word, length) == 0;
+		}
+
+		// The quoted name after #include
+		static bool includeName(const char* text, const char* end, std::string& name){
+			text = skipBlanks(text, end);
+			if(text == end || *text != '"'){
+				return false;
+			}
+			const char* close = (const char*)memchr(text + 1, '"', end - text - 1);
+			if(close == NULL || close == text + 1){
+				return false;
+			}
+			name.assign(text + 1, close - text - 1);
+			return true;
+		}
+
+		static std::string directoryOf(const std::string& path){
+			size_t slash = path.find_last_of("/\\");
+			return slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+		}
+};
+#endif
\ No newline at end of file
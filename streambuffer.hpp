@@ -0,0 +1,197 @@
+#ifndef STREAMBUFFER_H
+#define STREAMBUFFER_H
+
+#include "glad/glad.h"
+#include "glstate.hpp"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+// Ring of equally sized regions inside one buffer object. The CPU writes one
+// region while the GPU may still be reading the others; each region carries the
+// fence of the last frame that drew from it, so a writer only waits when it
+// laps the GPU.
+//
+// With ARB_buffer_storage the whole buffer is mapped once, persistent and
+// coherent. Otherwise each write maps its region with GL_MAP_UNSYNCHRONIZED_BIT
+// and the fences do the synchronization the driver would have done.
+class StreamBuffer{
+	public:
+		static const int MAX_REGIONS = 4;
+
+		unsigned int ID;
+
+		StreamBuffer(GLenum target, size_t regionSize, int regionCount = 3){
+			this->target = target;
+			// Keep region offsets aligned for attribute pointers and SIMD stores
+			this->regionSize = (regionSize + 255) & ~(size_t)255;
+			this->regionCount = regionCount;
+			current = 0;
+			writing = -1;
+			mapped = NULL;
+			for(int i = 0; i < MAX_REGIONS; i++){
+				fences[i] = 0;
+			}
+			if(this->regionCount > MAX_REGIONS){
+				this->regionCount = MAX_REGIONS;
+			}
+
+			glGenBuffers(1, &ID);
+			glState().bindBuffer(target, ID);
+			GLsizeiptr totalSize = (GLsizeiptr)(this->regionSize*this->regionCount);
+			if(GLAD_GL_ARB_buffer_storage){
+				GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+				glBufferStorage(target, totalSize, NULL, flags);
+				mapped = (char*)glMapBufferRange(target, 0, totalSize, flags);
+				if(mapped == NULL){
+					printf("Persistent mapping failed, falling back to unsynchronized maps\n");
+					glDeleteBuffers(1, &ID);
+					glState().forgetBuffer(ID);
+					glGenBuffers(1, &ID);
+					glState().bindBuffer(target, ID);
+				}
+			}
+			if(mapped == NULL){
+				glBufferData(target, totalSize, NULL, GL_STREAM_DRAW);
+			}
+		}
+
+		~StreamBuffer(){
+			for(int i = 0; i < regionCount; i++){
+				if(fences[i]){
+					glDeleteSync(fences[i]);
+				}
+			}
+			if(mapped){
+				glState().bindBuffer(target, ID);
+				glUnmapBuffer(target);
+			}
+			glDeleteBuffers(1, &ID);
+			glState().forgetBuffer(ID);
+		}
+
+		bool persistent(){
+			return mapped != NULL;
+		}
+
+		size_t size(){
+			return regionSize;
+		}
+
+		int regions(){
+			return regionCount;
+		}
+
+		// Region draws currently read from, offset() is its byte offset
+		int region(){
+			return current;
+		}
+
+		// Region the next beginWrite() will hand out
+		int nextRegion(){
+			return (current + 1) % regionCount;
+		}
+
+		// Returns a write pointer to the next region, waiting only if the GPU still reads it.
+		// Pass discard = false when only part of the region is rewritten and the rest must survive.
+		void* beginWrite(bool discard = true){
+			writing = nextRegion();
+			waitRegion(writing);
+			if(mapped){
+				return mapped + regionSize*writing;
+			}
+			GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+			if(discard){
+				access |= GL_MAP_INVALIDATE_RANGE_BIT;
+			}
+			glState().bindBuffer(target, ID);
+			return glMapBufferRange(target, regionSize*writing, regionSize, access);
+		}
+
+		// Finishes the write started by beginWrite() and returns the byte offset to draw from
+		size_t endWrite(){
+			if(!mapped){
+				glState().bindBuffer(target, ID);
+				glUnmapBuffer(target);
+			}
+			current = writing;
+			writing = -1;
+			return offset();
+		}
+
+		// Starts a write to the next region made of copy() calls, which may take several
+		// frames; draws keep reading the current region until endCopy(). Waits only if
+		// the GPU still reads the next region.
+		void beginCopy(){
+			writing = nextRegion();
+			waitRegion(writing);
+		}
+
+		// Copies size bytes of data to offset in the region beginCopy() started
+		void copy(size_t offset, const void* data, size_t size){
+			if(mapped){
+				memcpy(mapped + regionSize*writing + offset, data, size);
+				return;
+			}
+			// Mapped only for the copy, a buffer cannot be drawn from while it is mapped
+			glState().bindBuffer(target, ID);
+			void* out = glMapBufferRange(target, regionSize*writing + offset, size, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+			memcpy(out, data, size);
+			glUnmapBuffer(target);
+		}
+
+		// Makes the region beginCopy() started current and returns its byte offset
+		size_t endCopy(){
+			current = writing;
+			writing = -1;
+			return offset();
+		}
+
+		// Makes the next region current without mapping it, for the GPU to write itself.
+		// Needs no wait, GL orders the writes after the draws still reading the region.
+		// Returns its byte offset.
+		size_t gpuWrite(){
+			current = nextRegion();
+			return offset();
+		}
+
+		// Byte offset of the region draws currently read from
+		size_t offset(){
+			return regionSize*current;
+		}
+
+		// Call after the frame's last draw reading offset()
+		void fence(){
+			if(fences[current]){
+				glDeleteSync(fences[current]);
+			}
+			fences[current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		}
+
+	private:
+		GLenum target;
+		size_t regionSize;
+		int regionCount;
+		int current;
+		int writing;
+		char* mapped;
+		GLsync fences[MAX_REGIONS];
+
+		void waitRegion(int region){
+			if(!fences[region]){
+				return;
+			}
+			GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+			while(true){
+				GLenum result = glClientWaitSync(fences[region], flags, 1000000);
+				if(result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED || result == GL_WAIT_FAILED){
+					break;
+				}
+				flags = 0;
+			}
+			glDeleteSync(fences[region]);
+			fences[region] = 0;
+		}
+};
+#endif
\ No newline at end of file
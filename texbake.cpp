@@ -0,0 +1,344 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#define STB_IMAGE_IMPLEMENTATION
+#include "include/stb_image.h"
+#include "texturefile.hpp"
+
+// Offline texture baker: decodes an image, box filters its mip chain and block
+// compresses every level into a texture file (texturefile.hpp) that the streamer
+// uploads without decoding anything. Opaque images become BC1, images with alpha BC3.
+//
+//   texbake [--format bc1|bc3] input output
+
+// Block colors in BC1's 4 color mode: endpoints as RGB565, their expansions to
+// 8 bits and the two colors between them
+struct ColorEndpoints{
+	unsigned short color0, color1;
+	int palette[4][3];
+};
+
+static unsigned short packRgb565(const float color[3]){
+	int r = (int)(color[0]*31.0f/255.0f + 0.5f);
+	int g = (int)(color[1]*63.0f/255.0f + 0.5f);
+	int b = (int)(color[2]*31.0f/255.0f + 0.5f);
+	r = r < 0 ? 0 : r > 31 ? 31 : r;
+	g = g < 0 ? 0 : g > 63 ? 63 : g;
+	b = b < 0 ? 0 : b > 31 ? 31 : b;
+	return (unsigned short)(r << 11 | g << 5 | b);
+}
+
+static void unpackRgb565(unsigned short color, int rgb[3]){
+	int r = color >> 11, g = (color >> 5) & 63, b = color & 31;
+	rgb[0] = r << 3 | r >> 2;
+	rgb[1] = g << 2 | g >> 4;
+	rgb[2] = b << 3 | b >> 2;
+}
+
+static ColorEndpoints quantizeEndpoints(const float a[3], const float b[3]){
+	ColorEndpoints endpoints;
+	endpoints.color0 = packRgb565(a);
+	endpoints.color1 = packRgb565(b);
+	unpackRgb565(endpoints.color0, endpoints.palette[0]);
+	unpackRgb565(endpoints.color1, endpoints.palette[1]);
+	for(int c = 0; c < 3; c++){
+		endpoints.palette[2][c] = (2*endpoints.palette[0][c] + endpoints.palette[1][c])/3;
+		endpoints.palette[3][c] = (endpoints.palette[0][c] + 2*endpoints.palette[1][c])/3;
+	}
+	return endpoints;
+}
+
+// Nearest palette color of each texel, returns the summed squared error
+static int chooseColorIndices(const unsigned char* texels, const ColorEndpoints& endpoints, int indices[16]){
+	int total = 0;
+	for(int i = 0; i < 16; i++){
+		int best = 0x7FFFFFFF;
+		for(int p = 0; p < 4; p++){
+			int dr = texels[i*4] - endpoints.palette[p][0];
+			int dg = texels[i*4 + 1] - endpoints.palette[p][1];
+			int db = texels[i*4 + 2] - endpoints.palette[p][2];
+			int error = dr*dr + dg*dg + db*db;
+			if(error < best){
+				best = error;
+				indices[i] = p;
+			}
+		}
+		total += best;
+	}
+	return total;
+}
+
+// BC1 color block of 16 RGBA texels, always in the 4 color mode BC3 decodes its
+// color block with. Endpoints start at the ends of the colors' principal axis,
+// then one least squares fit to the chosen indices moves them if that lowers the error.
+static void compressColorBlock(const unsigned char* texels, unsigned char* out){
+	float mean[3] = {0, 0, 0};
+	for(int i = 0; i < 16; i++){
+		for(int c = 0; c < 3; c++){
+			mean[c] += texels[i*4 + c];
+		}
+	}
+	for(int c = 0; c < 3; c++){
+		mean[c] /= 16.0f;
+	}
+	float covariance[6] = {0, 0, 0, 0, 0, 0};
+	for(int i = 0; i < 16; i++){
+		float r = texels[i*4] - mean[0], g = texels[i*4 + 1] - mean[1], b = texels[i*4 + 2] - mean[2];
+		covariance[0] += r*r;
+		covariance[1] += r*g;
+		covariance[2] += r*b;
+		covariance[3] += g*g;
+		covariance[4] += g*b;
+		covariance[5] += b*b;
+	}
+	// Power iteration from the luminance direction
+	float axis[3] = {0.299f, 0.587f, 0.114f};
+	for(int iteration = 0; iteration < 8; iteration++){
+		float x = covariance[0]*axis[0] + covariance[1]*axis[1] + covariance[2]*axis[2];
+		float y = covariance[1]*axis[0] + covariance[3]*axis[1] + covariance[4]*axis[2];
+		float z = covariance[2]*axis[0] + covariance[4]*axis[1] + covariance[5]*axis[2];
+		float length = x*x + y*y + z*z;
+		if(length < 1e-12f){
+			break;
+		}
+		length = 1.0f/sqrtf(length);
+		axis[0] = x*length;
+		axis[1] = y*length;
+		axis[2] = z*length;
+	}
+	float low = 0, high = 0;
+	for(int i = 0; i < 16; i++){
+		float t = (texels[i*4] - mean[0])*axis[0] + (texels[i*4 + 1] - mean[1])*axis[1] + (texels[i*4 + 2] - mean[2])*axis[2];
+		low = t < low ? t : low;
+		high = t > high ? t : high;
+	}
+	float a[3], b[3];
+	for(int c = 0; c < 3; c++){
+		a[c] = mean[c] + axis[c]*high;
+		b[c] = mean[c] + axis[c]*low;
+	}
+	ColorEndpoints endpoints = quantizeEndpoints(a, b);
+	int indices[16];
+	int error = chooseColorIndices(texels, endpoints, indices);
+
+	// Texel i is w*a + (1 - w)*b with w from its index; solve the 2x2 normal equations for a and b
+	static const float weights[4] = {1.0f, 0.0f, 2.0f/3.0f, 1.0f/3.0f};
+	float aa = 0, ab = 0, bb = 0, ax[3] = {0, 0, 0}, bx[3] = {0, 0, 0};
+	for(int i = 0; i < 16; i++){
+		float w = weights[indices[i]];
+		aa += w*w;
+		ab += w*(1.0f - w);
+		bb += (1.0f - w)*(1.0f - w);
+		for(int c = 0; c < 3; c++){
+			ax[c] += w*texels[i*4 + c];
+			bx[c] += (1.0f - w)*texels[i*4 + c];
+		}
+	}
+	float determinant = aa*bb - ab*ab;
+	if(determinant > 1e-6f){
+		for(int c = 0; c < 3; c++){
+			a[c] = (ax[c]*bb - bx[c]*ab)/determinant;
+			b[c] = (bx[c]*aa - ax[c]*ab)/determinant;
+		}
+		ColorEndpoints fitted = quantizeEndpoints(a, b);
+		int fittedIndices[16];
+		int fittedError = chooseColorIndices(texels, fitted, fittedIndices);
+		if(fittedError < error){
+			endpoints = fitted;
+			memcpy(indices, fittedIndices, sizeof(indices));
+		}
+	}
+
+	// color0 > color1 selects the 4 color mode; swapping the endpoints swaps index 0 with 1 and 2 with 3
+	if(endpoints.color0 < endpoints.color1){
+		unsigned short color = endpoints.color0;
+		endpoints.color0 = endpoints.color1;
+		endpoints.color1 = color;
+		for(int i = 0; i < 16; i++){
+			indices[i] ^= 1;
+		}
+	}
+	else if(endpoints.color0 == endpoints.color1){
+		for(int i = 0; i < 16; i++){
+			indices[i] = 0;
+		}
+	}
+	unsigned int bits = 0;
+	for(int i = 0; i < 16; i++){
+		bits |= (unsigned int)indices[i] << (2*i);
+	}
+	out[0] = (unsigned char)endpoints.color0;
+	out[1] = (unsigned char)(endpoints.color0 >> 8);
+	out[2] = (unsigned char)endpoints.color1;
+	out[3] = (unsigned char)(endpoints.color1 >> 8);
+	for(int i = 0; i < 4; i++){
+		out[4 + i] = (unsigned char)(bits >> (8*i));
+	}
+}
+
+// BC3 alpha block in its 8 value mode: the block's largest and smallest alpha and
+// six steps between them, 3 bit indices
+static void compressAlphaBlock(const unsigned char* texels, unsigned char* out){
+	int high = 0, low = 255;
+	for(int i = 0; i < 16; i++){
+		int alpha = texels[i*4 + 3];
+		high = alpha > high ? alpha : high;
+		low = alpha < low ? alpha : low;
+	}
+	int palette[8] = {high, low};
+	for(int p = 2; p < 8; p++){
+		palette[p] = ((8 - p)*high + (p - 1)*low)/7;
+	}
+	unsigned long long bits = 0;
+	if(high > low){
+		for(int i = 0; i < 16; i++){
+			int alpha = texels[i*4 + 3];
+			int best = 256, index = 0;
+			for(int p = 0; p < 8; p++){
+				int error = abs(alpha - palette[p]);
+				if(error < best){
+					best = error;
+					index = p;
+				}
+			}
+			bits |= (unsigned long long)index << (3*i);
+		}
+	}
+	out[0] = (unsigned char)high;
+	out[1] = (unsigned char)low;
+	for(int i = 0; i < 6; i++){
+		out[2 + i] = (unsigned char)(bits >> (8*i));
+	}
+}
+
+// Blocks of a width x height RGBA8 image, row by row; blocks past the edge repeat its last texels
+static std::vector<unsigned char> compressImage(uint32_t format, const unsigned char* pixels, int width, int height){
+	std::vector<unsigned char> blocks(textureFileLevelSize(format, width, height));
+	size_t blockSize = textureFileBlockSize(format);
+	unsigned char* out = blocks.data();
+	unsigned char texels[64];
+	for(int by = 0; by < height; by += 4){
+		for(int bx = 0; bx < width; bx += 4){
+			for(int y = 0; y < 4; y++){
+				int row = by + y < height ? by + y : height - 1;
+				for(int x = 0; x < 4; x++){
+					int column = bx + x < width ? bx + x : width - 1;
+					memcpy(texels + (y*4 + x)*4, pixels + ((size_t)row*width + column)*4, 4);
+				}
+			}
+			if(format == TEXTURE_FILE_BC3){
+				compressAlphaBlock(texels, out);
+			}
+			compressColorBlock(texels, out + blockSize - 8);
+			out += blockSize;
+		}
+	}
+	return blocks;
+}
+
+int main(int argc, char** argv){
+	int format = 0;
+	const char* paths[2] = {NULL, NULL};
+	int pathCount = 0;
+	for(int i = 1; i < argc; i++){
+		if(strcmp(argv[i], "--format") == 0 && i+1 < argc){
+			i++;
+			if(strcmp(argv[i], "bc1") == 0){
+				format = TEXTURE_FILE_BC1;
+			}
+			else if(strcmp(argv[i], "bc3") == 0){
+				format = TEXTURE_FILE_BC3;
+			}
+			else{
+				printf("Unknown format %s\n", argv[i]);
+				return -1;
+			}
+		}
+		else if(argv[i][0] != '-' && pathCount < 2){
+			paths[pathCount++] = argv[i];
+		}
+		else{
+			pathCount = 0;
+			break;
+		}
+	}
+	if(pathCount != 2){
+		printf("Usage: %s [--format bc1|bc3] input output\n", argv[0]);
+		return -1;
+	}
+
+	// GL's first row is the bottom one
+	stbi_set_flip_vertically_on_load(1);
+	int width, height, channels;
+	unsigned char* pixels = stbi_load(paths[0], &width, &height, &channels, 4);
+	if(pixels == NULL){
+		printf("Failed to load %s: %s\n", paths[0], stbi_failure_reason());
+		return -1;
+	}
+	if(format == 0){
+		format = TEXTURE_FILE_BC1;
+		for(size_t i = 0; i < (size_t)width*height; i++){
+			if(pixels[i*4 + 3] != 255){
+				format = TEXTURE_FILE_BC3;
+				break;
+			}
+		}
+	}
+
+	std::vector<TextureFileLevel> levels;
+	std::vector<std::vector<unsigned char> > blocks;
+	size_t rgbaSize = 0;
+	unsigned char* level = pixels;
+	int levelWidth = width, levelHeight = height;
+	while(true){
+		blocks.push_back(compressImage(format, level, levelWidth, levelHeight));
+		TextureFileLevel entry = {(uint32_t)levelWidth, (uint32_t)levelHeight, 0, (uint32_t)blocks.back().size()};
+		levels.push_back(entry);
+		rgbaSize += (size_t)levelWidth*levelHeight*4;
+		if(levelWidth == 1 && levelHeight == 1){
+			break;
+		}
+		unsigned char* half = halveRgba(level, levelWidth, levelHeight, &levelWidth, &levelHeight);
+		if(level != pixels){
+			free(level);
+		}
+		level = half;
+	}
+	if(level != pixels){
+		free(level);
+	}
+	stbi_image_free(pixels);
+
+	TextureFileHeader header;
+	memcpy(header.magic, textureFileMagic, 4);
+	header.version = textureFileVersion;
+	header.format = (uint32_t)format;
+	header.width = (uint32_t)width;
+	header.height = (uint32_t)height;
+	header.levels = (uint32_t)levels.size();
+	size_t offset = sizeof(header) + levels.size()*sizeof(TextureFileLevel);
+	for(size_t i = 0; i < levels.size(); i++){
+		levels[i].offset = (uint32_t)offset;
+		offset += levels[i].size;
+	}
+
+	FILE* file = fopen(paths[1], "wb");
+	if(file == NULL){
+		printf("Failed to open %s for writing\n", paths[1]);
+		return -1;
+	}
+	bool written = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(levels.data(), sizeof(TextureFileLevel), levels.size(), file) == levels.size();
+	for(size_t i = 0; i < blocks.size() && written; i++){
+		written = fwrite(blocks[i].data(), 1, blocks[i].size(), file) == blocks[i].size();
+	}
+	if(fclose(file) != 0 || !written){
+		printf("Failed to write %s\n", paths[1]);
+		remove(paths[1]);
+		return -1;
+	}
+	printf("Baked %s into %s: %dx%d, %d levels, %s, %.2f MB (%.2f MB as RGBA8)\n", paths[0], paths[1], width, height, (int)levels.size(),
+		format == TEXTURE_FILE_BC1 ? "BC1" : "BC3", offset/(1024.0*1024.0), rgbaSize/(1024.0*1024.0));
+	return 0;
+}
\ No newline at end of file
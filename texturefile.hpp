@@ -0,0 +1,115 @@
+#ifndef TEXTUREFILE_H
+#define TEXTUREFILE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Textures baked offline by texbake: the whole mip chain, block compressed, laid
+// out so each level goes to glCompressedTexImage2D straight from the mapped file.
+//
+// A file is a TextureFileHeader, a TextureFileLevel per level from the largest
+// down, then the levels' blocks. Fields are little endian. Blocks cover 4x4
+// texels, row by row from the bottom one like GL's, and a level's last row and
+// column of blocks repeat its edge texels into the padding.
+
+// Block formats, numbered like their D3D names
+enum TextureFileFormat{
+	// RGB, 8 bytes a block: GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+	TEXTURE_FILE_BC1 = 1,
+	// RGBA, 16 bytes a block, an alpha block then a BC1 color block: GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+	TEXTURE_FILE_BC3 = 3
+};
+
+struct TextureFileHeader{
+	char magic[4];
+	uint32_t version;
+	uint32_t format;
+	uint32_t width;
+	uint32_t height;
+	uint32_t levels;
+};
+
+struct TextureFileLevel{
+	uint32_t width;
+	uint32_t height;
+	// Bytes from the start of the file
+	uint32_t offset;
+	uint32_t size;
+};
+
+static const char textureFileMagic[4] = {'G', 'T', 'E', 'X'};
+static const uint32_t textureFileVersion = 1;
+
+inline size_t textureFileBlockSize(uint32_t format){
+	return format == TEXTURE_FILE_BC1 ? 8 : 16;
+}
+
+inline size_t textureFileLevelSize(uint32_t format, uint32_t width, uint32_t height){
+	return (size_t)((width + 3)/4)*((height + 3)/4)*textureFileBlockSize(format);
+}
+
+inline bool isTextureFile(const void* data, size_t size){
+	return size >= sizeof(TextureFileHeader) && memcmp(data, textureFileMagic, 4) == 0;
+}
+
+// NULL when data holds a texture file the header and level table of which can be
+// trusted, the reason it cannot otherwise. data must be 4 byte aligned.
+inline const char* checkTextureFile(const void* data, size_t size){
+	if(!isTextureFile(data, size)){
+		return "not a texture file";
+	}
+	const TextureFileHeader* header = (const TextureFileHeader*)data;
+	if(header->version != textureFileVersion){
+		return "unsupported texture file version";
+	}
+	if(header->format != TEXTURE_FILE_BC1 && header->format != TEXTURE_FILE_BC3){
+		return "unknown block format";
+	}
+	if(header->width == 0 || header->height == 0 || header->width > 65536 || header->height > 65536 || header->levels == 0 || header->levels > 17){
+		return "bad texture size";
+	}
+	if(size < sizeof(TextureFileHeader) + header->levels*sizeof(TextureFileLevel)){
+		return "truncated level table";
+	}
+	const TextureFileLevel* levels = (const TextureFileLevel*)(header + 1);
+	uint32_t width = header->width;
+	uint32_t height = header->height;
+	for(uint32_t i = 0; i < header->levels; i++){
+		if(levels[i].width != width || levels[i].height != height || levels[i].size != textureFileLevelSize(header->format, width, height)){
+			return "bad mip level size";
+		}
+		if(levels[i].offset > size || levels[i].size > size - levels[i].offset){
+			return "truncated mip level";
+		}
+		width = width > 1 ? width/2 : 1;
+		height = height > 1 ? height/2 : 1;
+	}
+	return NULL;
+}
+
+// Next mip level of a width x height RGBA8 image, each texel the average of a 2x2
+// block. Odd sizes round down, their last row and column repeat into the block.
+// The pixels are malloc'd.
+inline unsigned char* halveRgba(const unsigned char* pixels, int width, int height, int* halfWidth, int* halfHeight){
+	int w = width > 1 ? width/2 : 1;
+	int h = height > 1 ? height/2 : 1;
+	unsigned char* half = (unsigned char*)malloc((size_t)w*h*4);
+	size_t rowSize = (size_t)width*4;
+	for(int y = 0; y < h; y++){
+		const unsigned char* row0 = pixels + (size_t)(2*y < height ? 2*y : height - 1)*rowSize;
+		const unsigned char* row1 = pixels + (size_t)(2*y + 1 < height ? 2*y + 1 : height - 1)*rowSize;
+		unsigned char* out = half + (size_t)y*w*4;
+		for(int x = 0; x < w; x++){
+			int x0 = (2*x < width ? 2*x : width - 1)*4;
+			int x1 = (2*x + 1 < width ? 2*x + 1 : width - 1)*4;
+			for(int c = 0; c < 4; c++){
+				out[x*4 + c] = (unsigned char)((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2)/4);
+			}
+		}
+	}
+	*halfWidth = w;
+	*halfHeight = h;
+	return half;
+}
+#endif
\ No newline at end of file
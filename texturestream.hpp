@@ -0,0 +1,511 @@
+#ifndef TEXTURESTREAM_H
+#define TEXTURESTREAM_H
+
+#include "glad/glad.h"
+#include "glstate.hpp"
+#include "gridgen.hpp"
+#include "mappedfile.hpp"
+#include "streambuffer.hpp"
+#include "texturefile.hpp"
+#include "include/stb_image.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// stb_image's parallel_for over a GridWorkers pool: restart intervals and row
+// bands of one image are decoded on all its threads
+inline void stbiParallelFor(void* user, stbi_parallel_task* task, void* data, int count){
+	((GridWorkers*)user)->run(count, [=](int first, int last){
+		task(data, first, last);
+	});
+}
+
+// Loads image files into textures without stalling a frame. Worker threads read
+// and decode them with stbi_load_from_memory and box filter the mip chain; the
+// render thread copies rows of every level into a ring of pixel unpack buffers,
+// one region a frame at most, and glTexSubImage2D pulls them from there on the
+// GPU's timeline. A large image streams in over several frames. glGenerateMipmap
+// is left out, drivers that run it on the CPU would stall the frame it lands in.
+// Until its last level is in, a texture is drawn with a placeholder.
+//
+// Texture files baked by texbake skip all of that: a worker maps the file and
+// checks its level table, and update() hands rows of each level's blocks to
+// glCompressedTexSubImage2D straight from the mapping, nothing decoded or filtered
+// on the CPU. BC1 takes an eighth of the memory of RGBA8, BC3 a quarter.
+class TextureStreamer{
+	public:
+		// Loads that finished, and loads that failed to read or decode
+		int ready;
+		int failed;
+
+		// Needs a current GL context. bytesPerFrame bounds the pixels update() uploads.
+		TextureStreamer(int threadCount, size_t bytesPerFrame = 4*1024*1024){
+			ready = 0;
+			failed = 0;
+			stopping = false;
+			stream = new StreamBuffer(GL_PIXEL_UNPACK_BUFFER, bytesPerFrame);
+			glState().bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+			// Grey checkers until the real texture is in
+			const unsigned int checkers[4] = {0xFF808080u, 0xFF404040u, 0xFF404040u, 0xFF808080u};
+			glGenTextures(1, &placeholder);
+			glState().bindTexture(0, GL_TEXTURE_2D, placeholder);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 2, 2, 0, GL_RGBA, GL_UNSIGNED_BYTE, checkers);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+			if(threadCount < 1){
+				threadCount = 1;
+			}
+			loaderCount = threadCount;
+			splitJob = NULL;
+			// Another user's hook, like a second streamer's, stays; images then decode on one loader each
+			stbi_set_parallel_for(parallelFor, this);
+			for(int i = 0; i < threadCount; i++){
+				workers.push_back(std::thread(&TextureStreamer::workerLoop, this));
+			}
+		}
+
+		~TextureStreamer(){
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stopping = true;
+			}
+			wake.notify_all();
+			for(size_t i = 0; i < workers.size(); i++){
+				workers[i].join();
+			}
+			stbi_set_parallel_for(NULL, this);
+			for(size_t i = 0; i < loads.size(); i++){
+				freeLevels(loads[i]);
+				if(loads[i]->texture){
+					glDeleteTextures(1, &loads[i]->texture);
+					glState().forgetTexture(loads[i]->texture);
+				}
+				delete loads[i];
+			}
+			glDeleteTextures(1, &placeholder);
+			glState().forgetTexture(placeholder);
+			delete stream;
+		}
+
+		// Queues path for loading and returns its handle for texture()
+		int load(const char* path){
+			Load* load = new Load();
+			load->path = path;
+			load->texture = 0;
+			load->file = NULL;
+			load->blockFormat = 0;
+			load->level = 0;
+			load->rowsUploaded = 0;
+			load->ready = false;
+			load->start = std::chrono::steady_clock::now();
+			loads.push_back(load);
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				queued.push_back(load);
+			}
+			wake.notify_one();
+			return (int)loads.size() - 1;
+		}
+
+		// Texture to draw handle with, the placeholder while it is loading or when it failed
+		unsigned int texture(int handle){
+			if(handle < 0 || handle >= (int)loads.size() || !loads[handle]->ready){
+				return placeholder;
+			}
+			return loads[handle]->texture;
+		}
+
+		int count(){
+			return (int)loads.size();
+		}
+
+		// Loads not ready or failed yet
+		int pending(){
+			return (int)loads.size() - ready - failed;
+		}
+
+		// Uploads up to bytesPerFrame of decoded rows and texture file levels, oldest load first. Call once a frame on the render thread.
+		void update(){
+			takeDecoded();
+			if(uploading.empty()){
+				return;
+			}
+
+			// Fill one region, then point a glTexSubImage2D at each load's rows in it
+			char* region = (char*)stream->beginWrite();
+			size_t used = 0;
+			// Bytes of texture file levels uploaded, they count against the region's size too
+			size_t blockBytes = 0;
+			pieces.clear();
+			bool allocated = false;
+			for(size_t i = 0; i < uploading.size(); i++){
+				Load* load = uploading[i];
+				if(!load->texture && allocated){
+					break;
+				}
+				if(!load->texture){
+					allocate(load);
+					allocated = true;
+				}
+				if(load->file){
+					// Rows of blocks go from the mapping straight to the texture, under the same budget
+					glState().bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+					glState().bindTexture(0, GL_TEXTURE_2D, load->texture);
+					while(load->level < (int)load->blockLevels.size()){
+						const TextureFileLevel& level = load->blockLevels[load->level];
+						int blockRows = (int)(level.height + 3)/4;
+						size_t rowSize = level.size/blockRows;
+						int rows = (int)((stream->size() - used - blockBytes)/rowSize);
+						if(rows > blockRows - load->rowsUploaded){
+							rows = blockRows - load->rowsUploaded;
+						}
+						if(rows == 0){
+							break;
+						}
+						// The last row of blocks may be cut by the level's edge
+						int firstRow = load->rowsUploaded*4;
+						int height = rows*4 < (int)level.height - firstRow ? rows*4 : (int)level.height - firstRow;
+						glCompressedTexSubImage2D(GL_TEXTURE_2D, load->level, 0, firstRow, level.width, height, load->blockFormat, (int)(rows*rowSize), load->file->data + level.offset + load->rowsUploaded*rowSize);
+						load->rowsUploaded += rows;
+						blockBytes += rows*rowSize;
+						if(load->rowsUploaded == blockRows){
+							load->level++;
+							load->rowsUploaded = 0;
+						}
+					}
+					if(load->level < (int)load->blockLevels.size()){
+						break;
+					}
+					finish(load);
+					continue;
+				}
+				// Levels fill the region in order, a load with room left over moves on to the next
+				while(load->level < (int)load->levels.size()){
+					const Level& level = load->levels[load->level];
+					size_t rowSize = (size_t)level.width*4;
+					int rows = (int)((stream->size() - used - blockBytes)/rowSize);
+					if(rows > level.height - load->rowsUploaded){
+						rows = level.height - load->rowsUploaded;
+					}
+					if(rows == 0){
+						break;
+					}
+					memcpy(region + used, level.pixels + load->rowsUploaded*rowSize, rows*rowSize);
+					Piece piece = {load, load->level, load->rowsUploaded, rows, used};
+					pieces.push_back(piece);
+					load->rowsUploaded += rows;
+					used += rows*rowSize;
+					if(load->rowsUploaded == level.height){
+						load->level++;
+						load->rowsUploaded = 0;
+					}
+				}
+				if(load->level < (int)load->levels.size()){
+					break;
+				}
+			}
+			size_t offset = stream->endWrite();
+
+			glState().bindBuffer(GL_PIXEL_UNPACK_BUFFER, stream->ID);
+			for(size_t i = 0; i < pieces.size(); i++){
+				Load* load = pieces[i].load;
+				const Level& level = load->levels[pieces[i].level];
+				glState().bindTexture(0, GL_TEXTURE_2D, load->texture);
+				glTexSubImage2D(GL_TEXTURE_2D, pieces[i].level, 0, pieces[i].firstRow, level.width, pieces[i].rows, GL_RGBA, GL_UNSIGNED_BYTE, (const void*)(offset + pieces[i].offset));
+				if(load->level == (int)load->levels.size() && pieces[i].level == load->level - 1 && pieces[i].firstRow + pieces[i].rows == level.height){
+					finish(load);
+				}
+			}
+			// Later client memory uploads, like the level of detail texture's, read no buffer
+			glState().bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			stream->fence();
+
+			size_t done = 0;
+			while(done < uploading.size() && uploading[done]->ready){
+				done++;
+			}
+			uploading.erase(uploading.begin(), uploading.begin() + done);
+		}
+
+	private:
+		// RGBA8 rows of a mip level, bottom row first
+		struct Level{
+			int width, height;
+			unsigned char* pixels;
+		};
+
+		struct Load{
+			std::string path;
+			unsigned int texture;
+			// Level 0 is stbi's image, the rest are filtered from it; freed once uploaded
+			std::vector<Level> levels;
+			// Texture files instead: the mapping, unmapped once uploaded, the GL format and the level table
+			MappedFile* file;
+			unsigned int blockFormat;
+			std::vector<TextureFileLevel> blockLevels;
+			// Next rows to upload, rows of blocks for texture files
+			int level;
+			int rowsUploaded;
+			bool ready;
+			std::string error;
+			std::chrono::steady_clock::time_point start;
+		};
+
+		// Rows of a load copied into the current region at offset
+		struct Piece{
+			Load* load;
+			int level;
+			int firstRow;
+			int rows;
+			size_t offset;
+		};
+
+		StreamBuffer* stream;
+		unsigned int placeholder;
+		// Every load by handle; read and written by the render thread only
+		std::vector<Load*> loads;
+		// Decoded loads with rows left to upload, in the order they were decoded
+		std::deque<Load*> uploading;
+		std::vector<Piece> pieces;
+
+		// Loads waiting for a worker, and decoded ones waiting for the render thread
+		std::vector<std::thread> workers;
+		std::mutex mutex;
+		std::condition_variable wake;
+		std::deque<Load*> queued;
+		std::vector<Load*> decoded;
+		bool stopping;
+
+		// Restart intervals or row bands of the one decode split at a time, handed out
+		// in slices to the loaders with nothing queued and run by the decoding loader
+		// too; the others decode on their loader alone. Guarded by mutex.
+		struct SplitJob{
+			stbi_parallel_task* task;
+			void* data;
+			int count;
+			int slice;
+			// Next item to hand out, slices handed out and still running
+			int next;
+			int running;
+		};
+		int loaderCount;
+		SplitJob* splitJob;
+		std::condition_variable splitDone;
+
+		static void parallelFor(void* user, stbi_parallel_task* task, void* data, int count){
+			TextureStreamer* streamer = (TextureStreamer*)user;
+			std::unique_lock<std::mutex> lock(streamer->mutex);
+			if(streamer->splitJob){
+				lock.unlock();
+				task(data, 0, count);
+				return;
+			}
+			// A few slices a loader, so ones that join late still find work
+			int slice = count/(4*streamer->loaderCount);
+			SplitJob job = {task, data, count, slice > 1 ? slice : 1, 0, 0};
+			streamer->splitJob = &job;
+			streamer->wake.notify_all();
+			streamer->runSlices(lock, job);
+			streamer->splitDone.wait(lock, [&job]{ return job.running == 0; });
+			streamer->splitJob = NULL;
+		}
+
+		// Runs slices of job until none are left, with mutex held on entry and return
+		void runSlices(std::unique_lock<std::mutex>& lock, SplitJob& job){
+			while(job.next < job.count){
+				int first = job.next;
+				int last = first + job.slice < job.count ? first + job.slice : job.count;
+				job.next = last;
+				job.running++;
+				lock.unlock();
+				job.task(job.data, first, last);
+				lock.lock();
+				job.running--;
+			}
+			if(job.running == 0){
+				splitDone.notify_all();
+			}
+		}
+
+		// Queues the rows and levels of decoded loads, reports the ones that failed
+		void takeDecoded(){
+			std::vector<Load*> done;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				done.swap(decoded);
+			}
+			for(size_t i = 0; i < done.size(); i++){
+				Load* load = done[i];
+				if(load->levels.empty() && !load->file){
+					failed++;
+					printf("Failed to load texture %s: %s\n", load->path.c_str(), load->error.c_str());
+					continue;
+				}
+				if(load->file && !GLAD_GL_EXT_texture_compression_s3tc){
+					failed++;
+					printf("Failed to load texture %s: S3TC texture compression is not supported\n", load->path.c_str());
+					freeLevels(load);
+					continue;
+				}
+				if(load->file && load->blockLevels[0].size/((load->blockLevels[0].height + 3)/4) > stream->size()){
+					failed++;
+					printf("Failed to load texture %s: rows of %d blocks do not fit the upload buffer\n", load->path.c_str(), (int)(load->blockLevels[0].width + 3)/4);
+					freeLevels(load);
+					continue;
+				}
+				if(!load->file && (size_t)load->levels[0].width*4 > stream->size()){
+					failed++;
+					printf("Failed to load texture %s: rows of %d pixels do not fit the upload buffer\n", load->path.c_str(), load->levels[0].width);
+					freeLevels(load);
+					continue;
+				}
+				uploading.push_back(load);
+			}
+		}
+
+		// Creates the texture of load with room for all its levels. Drivers may clear or
+		// commit the memory right away, so update() allocates one texture a frame at most.
+		static void allocate(Load* load){
+			glGenTextures(1, &load->texture);
+			glState().bindTexture(0, GL_TEXTURE_2D, load->texture);
+			int levelCount = (int)(load->file ? load->blockLevels.size() : load->levels.size());
+			if(GLAD_GL_ARB_texture_storage){
+				if(load->file){
+					glTexStorage2D(GL_TEXTURE_2D, levelCount, load->blockFormat, load->blockLevels[0].width, load->blockLevels[0].height);
+				}
+				else{
+					glTexStorage2D(GL_TEXTURE_2D, levelCount, GL_RGBA8, load->levels[0].width, load->levels[0].height);
+				}
+			}
+			else{
+				// NULL would be an offset into a bound unpack buffer
+				glState().bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+				for(int i = 0; i < levelCount; i++){
+					if(load->file){
+						const TextureFileLevel& level = load->blockLevels[i];
+						glCompressedTexImage2D(GL_TEXTURE_2D, i, load->blockFormat, level.width, level.height, 0, level.size, NULL);
+					}
+					else{
+						glTexImage2D(GL_TEXTURE_2D, i, GL_RGBA8, load->levels[i].width, load->levels[i].height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+					}
+				}
+			}
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levelCount - 1);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		}
+
+		void workerLoop(){
+			while(true){
+				Load* load;
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					wake.wait(lock, [this]{ return stopping || !queued.empty() || (splitJob && splitJob->next < splitJob->count); });
+					if(stopping){
+						return;
+					}
+					if(queued.empty()){
+						runSlices(lock, *splitJob);
+						continue;
+					}
+					load = queued.front();
+					queued.pop_front();
+				}
+				decode(load);
+				std::lock_guard<std::mutex> lock(mutex);
+				decoded.push_back(load);
+			}
+		}
+
+		// Maps the whole file. Images are decoded from the mapping, so the disk and the
+		// decoder never wait on each other per byte. Texture files keep it for update()
+		// and have their pages read in here, where a page fault stalls no frame.
+		static void decode(Load* load){
+			MappedFile* file = new MappedFile(load->path.c_str());
+			if(file->data == NULL){
+				delete file;
+				load->error = "cannot open file";
+				return;
+			}
+			if(isTextureFile(file->data, file->size)){
+				const char* error = checkTextureFile(file->data, file->size);
+				if(error){
+					delete file;
+					load->error = error;
+					return;
+				}
+				const TextureFileHeader* header = (const TextureFileHeader*)file->data;
+				const TextureFileLevel* levels = (const TextureFileLevel*)(header + 1);
+				load->blockLevels.assign(levels, levels + header->levels);
+				load->blockFormat = header->format == TEXTURE_FILE_BC1 ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+				volatile char touched = 0;
+				for(size_t i = 0; i < file->size; i += 4096){
+					touched += file->data[i];
+				}
+				load->file = file;
+				return;
+			}
+			Level level;
+			int channels;
+			// GL's first row is the bottom one
+			stbi_set_flip_vertically_on_load_thread(1);
+			level.pixels = stbi_load_from_memory((const stbi_uc*)file->data, (int)file->size, &level.width, &level.height, &channels, 4);
+			delete file;
+			if(level.pixels == NULL){
+				// Thread local in stb_image
+				load->error = stbi_failure_reason();
+				return;
+			}
+			load->levels.push_back(level);
+			while(level.width > 1 || level.height > 1){
+				level.pixels = halveRgba(level.pixels, level.width, level.height, &level.width, &level.height);
+				load->levels.push_back(level);
+			}
+		}
+
+		// Reports load and lets go of its pixels or mapping
+		void finish(Load* load){
+			int levelCount = (int)(load->file ? load->blockLevels.size() : load->levels.size());
+			int width = load->file ? (int)load->blockLevels[0].width : load->levels[0].width;
+			int height = load->file ? (int)load->blockLevels[0].height : load->levels[0].height;
+			size_t bytes = 0;
+			for(int i = 0; i < levelCount; i++){
+				bytes += load->file ? load->blockLevels[i].size : (size_t)load->levels[i].width*load->levels[i].height*4;
+			}
+			const char* format = load->blockFormat == GL_COMPRESSED_RGB_S3TC_DXT1_EXT ? "BC1" : load->blockFormat ? "BC3" : "RGBA8";
+			printf("Texture %s ready, %dx%d, %d levels, %.2f MB %s in %.2f ms\n", load->path.c_str(), width, height, levelCount, bytes/(1024.0*1024.0), format,
+				std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - load->start).count());
+			freeLevels(load);
+			load->ready = true;
+			ready++;
+		}
+
+		// Level 0 belongs to stbi, the rest to malloc; texture files are unmapped
+		static void freeLevels(Load* load){
+			for(size_t i = 0; i < load->levels.size(); i++){
+				if(i == 0){
+					stbi_image_free(load->levels[i].pixels);
+				}
+				else{
+					free(load->levels[i].pixels);
+				}
+			}
+			load->levels.clear();
+			delete load->file;
+			load->file = NULL;
+		}
+};
+#endif
\ No newline at end of file
@@ -0,0 +1,118 @@
+#ifndef VERTEXFORMAT_H
+#define VERTEXFORMAT_H
+
+#include "glad/glad.h"
+#include "gridgen.hpp"
+
+#include <stddef.h>
+#include <string.h>
+
+// Vertex layouts for the expanded grid (4 vertices per cell), chosen at startup
+enum VertexFormat{
+	VERTEX_FORMAT_FLOAT,		// vec3 position, vec3 color, vec2 texcoord as floats, 32 bytes
+	VERTEX_FORMAT_PACKED,		// uint16 corner position, RGBA8 color, 8 bytes
+	VERTEX_FORMAT_PACKED_UV,	// packed plus unorm16 texcoords, 12 bytes
+	VERTEX_FORMAT_VERTEXID,		// RGBA8 color only, position from gl_VertexID, 4 bytes
+	VERTEX_FORMAT_COUNT
+};
+
+struct VertexAttribute{
+	int location;
+	int components;
+	GLenum type;
+	GLboolean normalized;
+	size_t offset;
+};
+
+struct VertexFormatInfo{
+	const char* name;
+	int stride;
+	int attributeCount;
+	VertexAttribute attributes[3];
+	// File in the shader directory and the defines of its variant for this format
+	const char* vertexShader;
+	const char* vertexShaderDefines;
+};
+
+const VertexFormatInfo vertexFormats[VERTEX_FORMAT_COUNT] = {
+	{"float", 8*sizeof(float), 3, {
+			{0, 3, GL_FLOAT, GL_FALSE, 0},
+			{1, 3, GL_FLOAT, GL_FALSE, 3*sizeof(float)},
+			{2, 2, GL_FLOAT, GL_FALSE, 6*sizeof(float)}
+		},
+		"expanded.vs", "TEXCOORD"
+	},
+	{"packed", sizeof(PackedVertex), 2, {
+			{0, 2, GL_UNSIGNED_SHORT, GL_FALSE, offsetof(PackedVertex, x)},
+			{1, 4, GL_UNSIGNED_BYTE, GL_TRUE, offsetof(PackedVertex, color)}
+		},
+		"expanded.vs", "PACKED_POSITION"
+	},
+	{"packed-uv", sizeof(PackedTexVertex), 3, {
+			{0, 2, GL_UNSIGNED_SHORT, GL_FALSE, offsetof(PackedTexVertex, x)},
+			{1, 4, GL_UNSIGNED_BYTE, GL_TRUE, offsetof(PackedTexVertex, color)},
+			{2, 2, GL_UNSIGNED_SHORT, GL_TRUE, offsetof(PackedTexVertex, u)}
+		},
+		"expanded.vs", "PACKED_POSITION,TEXCOORD"
+	},
+	{"vertexid", sizeof(unsigned int), 1, {
+			{1, 4, GL_UNSIGNED_BYTE, GL_TRUE, 0}
+		},
+		"vertexid.vs", NULL
+	}
+};
+
+// Returns VERTEX_FORMAT_COUNT for unknown names
+inline VertexFormat vertexFormatFromName(const char* name){
+	for(int i = 0; i < VERTEX_FORMAT_COUNT; i++){
+		if(strcmp(vertexFormats[i].name, name) == 0){
+			return (VertexFormat)i;
+		}
+	}
+	return VERTEX_FORMAT_COUNT;
+}
+
+// Points the attributes of format at the bound GL_ARRAY_BUFFER, starting at offset
+inline void setVertexFormat(VertexFormat format, size_t offset){
+	const VertexFormatInfo& info = vertexFormats[format];
+	for(int i = 0; i < info.attributeCount; i++){
+		const VertexAttribute& attribute = info.attributes[i];
+		glVertexAttribPointer(attribute.location, attribute.components, attribute.type, attribute.normalized, info.stride, (void*)(offset + attribute.offset));
+	}
+}
+
+// Enables exactly the attributes of format on the bound VAO
+inline void enableVertexFormat(VertexFormat format){
+	const VertexFormatInfo& info = vertexFormats[format];
+	for(int location = 0; location < 3; location++){
+		bool used = false;
+		for(int i = 0; i < info.attributeCount; i++){
+			used = used || info.attributes[i].location == location;
+		}
+		if(used){
+			glEnableVertexAttribArray(location);
+		}
+		else{
+			glDisableVertexAttribArray(location);
+		}
+	}
+}
+
+// Writes the 4 vertices of cells [first, last) in format. vertices points at the start of the buffer.
+inline void expandVertices(VertexFormat format, void* vertices, const GridInstance* instances, size_t first, size_t last){
+	switch(format){
+		case VERTEX_FORMAT_FLOAT:
+			expandInstances((float*)vertices, instances, first, last);
+			break;
+		case VERTEX_FORMAT_PACKED:
+			expandInstancesPacked((PackedVertex*)vertices, instances, first, last);
+			break;
+		case VERTEX_FORMAT_PACKED_UV:
+			expandInstancesPackedTex((PackedTexVertex*)vertices, instances, first, last);
+			break;
+		default:
+			expandInstancesColor((unsigned int*)vertices, instances, first, last);
+			break;
+	}
+}
+#endif
\ No newline at end of file